@@ -0,0 +1,49 @@
+#ifndef ALEPH_ALLOC_H
+#define ALEPH_ALLOC_H
+
+#include <aleph/defs.h>
+
+#define ARENA_ALIGN 16
+
+typedef struct Arena_Block {
+    struct Arena_Block *next;
+    size_t size, used;
+} Arena_Block;
+
+/* Bump allocator. Resetting rewinds every block without freeing any, so an
+ * arena that has grown to its working size never touches the system
+ * allocator again. */
+typedef struct {
+    Arena_Block *first, *cur;
+    size_t block_size;
+} Arena;
+
+#define ARENA_NEW(_arena, _type) (arena_alloc(_arena, sizeof(_type)))
+#define ARENA_NEW_ARR(_arena, _type, _len) \
+    (arena_alloc(_arena, sizeof(_type) * (_len)))
+
+void arena_init(Arena *arena, size_t block_size);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+/* Fixed size object pool over one contiguous block, so objects can also be
+ * addressed by index. */
+typedef struct {
+    uint8_t *data;
+    size_t elem_size, count;
+    void *free_list;
+} Pool;
+
+void pool_init(Pool *pool, size_t elem_size, size_t count);
+void *pool_get(Pool *pool);
+void pool_put(Pool *pool, void *ptr);
+size_t pool_index(Pool *pool, const void *ptr);
+void *pool_at(Pool *pool, size_t index);
+void pool_free(Pool *pool);
+
+/* Marks the calling thread as realtime. With ALEPH_DEBUG_ALLOC defined, any
+ * NEW, NEW_ARR or FREE on a realtime thread fails loudly. */
+void alloc_set_realtime(bool realtime);
+
+#endif /* ALEPH_ALLOC_H */
@@ -1,13 +1,119 @@
 #ifndef ALEPH_AUDIO_H
 #define ALEPH_AUDIO_H
 
-void audio_init();
+#include <aleph/audio_file.h>
+#include <aleph/loudness.h>
+#include <aleph/meter.h>
+#include <aleph/param.h>
+#include <aleph/snap.h>
+#include <aleph/stretch.h>
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_MAX_SLICES 64
+#define AUDIO_NUM_SENDS 10
+
+/* Slice channels are indexed by Slice_Id, followed by the sends. */
+#define AUDIO_NUM_CHANNELS (AUDIO_MAX_SLICES + AUDIO_NUM_SENDS)
+
+typedef struct {
+    Meter_Level chans[AUDIO_NUM_CHANNELS];
+    Meter_Level master;
+} Audio_Meters;
+
+/* Per channel controls. Changes glide rather than jump. */
+typedef enum {
+    AUDIO_PARAM_VOLUME, /* Linear gain, 0 to 4. */
+    AUDIO_PARAM_DELAY_TIME, /* Seconds, up to 5. Output channels only. */
+    AUDIO_PARAM_DELAY_FEEDBACK, /* 0 to 0.99. Output channels only. */
+    AUDIO_PARAM_COUNT,
+} Audio_Param;
+
+/* How long the mixer took over each block while timing ran. Buckets are
+ * `bucket_us` wide and cover four deadlines; the last holds anything
+ * slower. */
+#define AUDIO_TIMING_BUCKETS 512
+
+typedef struct {
+    double deadline_us; /* The audio one block holds. */
+    double bucket_us;
+    uint64_t blocks;
+    uint64_t late; /* Blocks that took longer than the deadline. */
+    double max_us;
+    uint32_t counts[AUDIO_TIMING_BUCKETS];
+} Audio_Timing;
+
+typedef struct {
+    const char *backend; /* "portaudio" (default), "null" or "file". */
+    const char *path; /* Audio file to load, "test.wav" if NULL. */
+    const char *out_path; /* Output of the file backend. */
+    bool fast; /* Null/file backends render as fast as they can. */
+    double seconds; /* Null/file backends stop after this much audio; 0 runs on. */
+    const char *reverb; /* Impulse response for send 0, which slices then go to. */
+    float reverb_mix;
+} Audio_Config;
+
+/* audio_load followed by audio_start. */
+void audio_init(const Audio_Config *config);
+/* The slow part: decodes the file, indexes it and loads the impulse
+ * response. Touches nothing but audio's own state, so it can run on
+ * another thread while the caller does something else. */
+void audio_load(const Audio_Config *config);
+/* Starts the backend, on the thread that will later call audio_stop. */
+void audio_start(const Audio_Config *config);
 
 void audio_set_file_index(size_t index);
 size_t audio_get_file_index();
 float *audio_get_file_data(size_t *len);
+const Audio_File *audio_get_file();
+
+/* Zero crossings and levels of the loaded file, for placing slice points. */
+const Snap_Index *audio_get_snap();
+/* Its loudness, for evening out slices. */
+const Loudness_Index *audio_get_loudness();
 void audio_stop();
 
+/* The levels as of the last block mixed. Never blocks the mixer; only one
+ * thread may read them, and the snapshot stays valid until its next call. */
+const Audio_Meters *audio_read_meters();
+
+/* Returns once the backend has produced Audio_Config.seconds of audio, to
+ * the frame on the null and file backends; with no limit, never. */
+void audio_wait();
+
+/* Seconds of audio the mixer has produced so far. */
+double audio_get_time();
+
+/* Frames the mixer has produced so far; the clock automation runs on. */
+uint64_t audio_get_frames();
+
+/* Times every block mixed from here on. */
+void audio_timing_start();
+
+/* Waits for the mixer to finish the block it is on, so it needs a running
+ * stream. The figures stay valid until the next start. */
+const Audio_Timing *audio_timing_stop();
+
+typedef struct {
+    size_t start, end; /* Frames of the loaded file, as audio_slice_begin(). */
+    int send; /* As audio_slice_set_send(). */
+    const char *path;
+} Audio_Export;
+
+/* Renders slices to WAV files, each played through once with its envelope,
+ * routing and effects and then left to ring out. Jobs are spread over a
+ * thread pool and run apart from the mixer, which keeps playing. Effects are
+ * taken as they are set now; automation is not followed. Returns how many
+ * files were written. */
+size_t audio_export(const Audio_Export *exports, size_t count);
+
+/* The same for every slice begun, as `dir`/slice_<id>.wav, with its own
+ * envelope and channel settings. */
+size_t audio_export_slices(const char *dir);
+
+/* Renders interleaved stereo frames without a device, e.g. for bouncing. Only
+ * call this while no stream is pulling from the mixer. */
+void audio_render(float *out, size_t frames);
+
 void audio_set_file_repeat(size_t start, size_t end);
 void audio_disable_file_repeat();
 
@@ -17,9 +123,76 @@ void audio_pause();
 typedef int Slice_Id;
 
 Slice_Id audio_slice_begin(size_t start, size_t end, bool loop);
+
+/* The mixer drops the slice at its next block, along with anything still
+ * scheduled for it, and only then is the id free to be begun again. */
 void audio_slice_end(Slice_Id id);
+
+/* As audio_slice_begin(), but -1 when every slice is taken. */
+Slice_Id audio_slice_try_begin(size_t start, size_t end, bool loop);
+
+/* Whether a slice has begun and not ended. */
+bool audio_slice_live(Slice_Id id);
+
 void audio_slice_set_index(Slice_Id id, size_t index);
 void audio_slice_play(Slice_Id id);
 void audio_slice_stop(Slice_Id id);
 
-#endif /* ALEPH_AUDIO_H */
\ No newline at end of file
+/* Routes a slice's channel to a send, or straight out for -1. */
+void audio_slice_set_send(Slice_Id id, int send);
+
+/* Plays a slice at `speed` times its own pace, 0.25 to 4, keeping its
+ * pitch: WSOLA for drums and other sharp material, the vocoder for tones.
+ * STRETCH_OFF plays it as recorded. */
+void audio_slice_set_stretch(Slice_Id id, Stretch_Mode mode, float speed);
+
+/* Scales a slice's output, on top of its envelope and its channel's volume. */
+void audio_slice_set_gain(Slice_Id id, float gain);
+
+/* Sets a slice's gain so its span of the file plays at `lufs` integrated
+ * loudness, within what keeps its peak from clipping. Slices too quiet to
+ * measure are left at unity. Returns the gain, or 0 for a slice that has
+ * ended, which is left alone. */
+float audio_slice_normalize(Slice_Id id, float lufs);
+
+/* Sets the sustain level of a slice's envelope, 0 to 1. */
+void audio_slice_set_sustain(Slice_Id id, float level);
+
+/* The same, landing on mixer frame `frame` of the audio_get_frames() clock
+ * instead of the next block; a frame already past means right away. Plays,
+ * stops and jumps land on the frame itself, the rest at the top of the block
+ * holding it. An end makes the slice no longer live straight away. */
+void audio_slice_play_at(Slice_Id id, uint64_t frame);
+void audio_slice_stop_at(Slice_Id id, uint64_t frame);
+void audio_slice_set_index_at(Slice_Id id, size_t index, uint64_t frame);
+void audio_slice_end_at(Slice_Id id, uint64_t frame);
+void audio_slice_set_send_at(Slice_Id id, int send, uint64_t frame);
+void audio_slice_set_stretch_at(Slice_Id id, Stretch_Mode mode, float speed, uint64_t frame);
+void audio_slice_set_gain_at(Slice_Id id, float gain, uint64_t frame);
+float audio_slice_normalize_at(Slice_Id id, float lufs, uint64_t frame);
+void audio_slice_set_sustain_at(Slice_Id id, float level, uint64_t frame);
+
+/* Channels are Slice_Ids, then AUDIO_MAX_SLICES + send. These never block the
+ * mixer: the change is queued and picked up at the start of the next block. */
+void audio_channel_set(int chan, Audio_Param param, float value);
+void audio_channel_set_at(int chan, Audio_Param param, float value, uint64_t frame);
+
+/* Replaces a control's automation with a line through `points`, whose frames
+ * are on the audio_get_frames() clock; an empty lane removes it. The points
+ * are copied. Automation overrides audio_channel_set() while it runs. */
+void audio_channel_automate(int chan, Audio_Param param, const Param_Point *points, size_t count);
+
+/* Convolves a send with the impulse response in a WAV file, mixing `mix` of
+ * it with the dry signal; NULL removes it. The file is loaded on the calling
+ * thread, which then waits a block for the mixer to swap it in. */
+bool audio_send_set_reverb(int send, const char *path, float mix);
+
+/* The same with an impulse response in memory, `frames` interleaved frames
+ * of `nchannels` channels. */
+void audio_send_set_impulse(int send, const float *ir, size_t frames, int nchannels, float mix);
+
+/* Routes a send into a later send, or straight out for -1. Sends are mixed
+ * in order, so a send can only feed one after it. */
+void audio_send_set_output(int send, int output);
+
+#endif /* ALEPH_AUDIO_H */
\ No newline at end of file
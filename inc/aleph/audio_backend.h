@@ -0,0 +1,32 @@
+#ifndef ALEPH_AUDIO_BACKEND_H
+#define ALEPH_AUDIO_BACKEND_H
+
+#include <aleph/defs.h>
+
+/* Fills `frames` frames of interleaved stereo output. */
+typedef void (*Audio_Render_Fn)(float *out, unsigned long frames);
+
+typedef struct {
+    int sample_rate;
+    int frames_per_buffer;
+    bool realtime; /* Null/file: pace blocks to the wall clock. */
+    const char *path; /* File: where to write the output. */
+    uint64_t max_frames; /* Null/file: stop after exactly this many; 0 for never. */
+} Audio_Backend_Config;
+
+typedef struct {
+    const char *name;
+    bool (*start)(const Audio_Backend_Config *config, Audio_Render_Fn render);
+    void (*stop)();
+    /* Returns once max_frames have been rendered. NULL where there's no
+     * limit to reach. */
+    void (*wait)();
+} Audio_Backend;
+
+extern const Audio_Backend audio_backend_portaudio;
+extern const Audio_Backend audio_backend_null;
+extern const Audio_Backend audio_backend_file;
+
+const Audio_Backend *audio_backend_find(const char *name);
+
+#endif /* ALEPH_AUDIO_BACKEND_H */
@@ -10,14 +10,31 @@ typedef enum {
 typedef struct {
     Sample_Type sample_t;
     int nchannels;
+    int sample_rate;
     union {
         float *f32;
     } data;
     size_t len; /* In samples. */
 } Audio_File;
 
+/* Loads a WAV or FLAC file, going by its first bytes. */
+bool audio_file_load(Audio_File *file, const char *path);
 bool audio_file_load_wav(Audio_File *file, const char *path);
 
+/* Streams interleaved float frames out as a 16 bit PCM WAV file. The header
+ * sizes are filled in on close. Once a write fails, say on a full disk, the
+ * rest are skipped; writes and the close return whether the file is whole. */
+typedef struct {
+    void *handle;
+    int nchannels;
+    size_t frames;
+    bool ok;
+} Wav_Writer;
+
+bool wav_writer_open(Wav_Writer *writer, const char *path, int nchannels, int sample_rate);
+bool wav_writer_write(Wav_Writer *writer, const float *data, size_t frames);
+bool wav_writer_close(Wav_Writer *writer);
+
 void audio_file_free(Audio_File *file);
 
-#endif /* ALEPH_AUDIO_FILE_H */
\ No newline at end of file
+#endif /* ALEPH_AUDIO_FILE_H */
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef ALEPH_CONV_H
+#define ALEPH_CONV_H
+
+#include <aleph/defs.h>
+
+/* Stereo partitioned convolution with no added latency. The head of the
+ * impulse response runs in CONV_BLOCK frame partitions every block; the tail
+ * runs in CONV_TAIL_BLOCK partitions with its work spread over the blocks
+ * in between, so long responses cost little more per block than short
+ * ones. */
+#define CONV_BLOCK 64
+#define CONV_TAIL_BLOCK 1024
+
+typedef struct Conv Conv;
+
+/* `ir` is `frames` interleaved frames of `nchannels` (1 or 2) channels and is
+ * copied. Heavy; never call from the audio thread. */
+Conv *conv_create(const float *ir, size_t frames, int nchannels, float gain);
+Conv *conv_load(const char *path, int sample_rate, float gain);
+
+/* The same response with none of `src`'s state, so it starts silent. Safe to
+ * call while `src` is processing on another thread. */
+Conv *conv_clone(const Conv *src);
+void conv_free(Conv *conv);
+
+/* Convolves interleaved stereo frames. `in` and `out` may be the same buffer
+ * and any number of frames can be passed; output is never delayed. */
+void conv_process(Conv *conv, const float *in, float *out, size_t frames);
+
+#endif /* ALEPH_CONV_H */
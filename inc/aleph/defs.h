@@ -8,17 +8,52 @@
 
 #define IGNORE(_var) ((void) (_var))
 
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#define NORETURN __declspec(noreturn)
+#else
+#define THREAD_LOCAL __thread
+#define NORETURN __attribute__((noreturn))
+#endif
+
+#ifdef ALEPH_DEBUG_ALLOC
+#define NEW(_type) (_alloc_checked(1, sizeof(_type), __FILE__, __LINE__))
+#define NEW_ARR(_type, _len) (_alloc_checked(_len, sizeof(_type), __FILE__, __LINE__))
+#define FREE(_ptr) _free_checked((void *) _ptr, __FILE__, __LINE__)
+#else
 #define NEW(_type) ((calloc(1, sizeof(_type))))
 #define NEW_ARR(_type, _len) ((calloc(_len, sizeof(_type))))
 #define FREE(_ptr) free((void *) _ptr)
+#endif
 
 #define FAIL(_reason) _fail(_reason, __FILE__, __LINE__)
 #define FAIL_FMT(_reason, ...) _fail(_reason, __FILE__, __LINE__, __VA_ARGS__)
 
-#define LOG(_reason) _log(_reason, __FILE__, __LINE__)
-#define LOG_FMT(_reason, ...) _log(_reason, __FILE__, __LINE__, __VA_ARGS__)
+typedef enum {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+} Log_Level;
+
+#define LOG(_reason) _log(LOG_LEVEL_INFO, _reason, __FILE__, __LINE__)
+#define LOG_FMT(_reason, ...) _log(LOG_LEVEL_INFO, _reason, __FILE__, __LINE__, __VA_ARGS__)
+
+#define LOG_DEBUG(_reason) _log(LOG_LEVEL_DEBUG, _reason, __FILE__, __LINE__)
+#define LOG_DEBUG_FMT(_reason, ...) _log(LOG_LEVEL_DEBUG, _reason, __FILE__, __LINE__, __VA_ARGS__)
+
+#define LOG_WARN(_reason) _log(LOG_LEVEL_WARN, _reason, __FILE__, __LINE__)
+#define LOG_WARN_FMT(_reason, ...) _log(LOG_LEVEL_WARN, _reason, __FILE__, __LINE__, __VA_ARGS__)
+
+#define LOG_ERROR(_reason) _log(LOG_LEVEL_ERROR, _reason, __FILE__, __LINE__)
+#define LOG_ERROR_FMT(_reason, ...) _log(LOG_LEVEL_ERROR, _reason, __FILE__, __LINE__, __VA_ARGS__)
+
+NORETURN void _fail(const char *fmt, const char *file, int line, ...);
+void _log(Log_Level level, const char *fmt, const char *file, int line, ...);
 
-void _fail(const char *fmt, const char *file, int line, ...);
-void _log(const char *fmt, const char *file, int line, ...);
+#ifdef ALEPH_DEBUG_ALLOC
+void *_alloc_checked(size_t count, size_t size, const char *file, int line);
+void _free_checked(void *ptr, const char *file, int line);
+#endif
 
 #endif /* ALEPH_DEFS_H */
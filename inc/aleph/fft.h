@@ -0,0 +1,21 @@
+#ifndef ALEPH_FFT_H
+#define ALEPH_FFT_H
+
+#include <aleph/defs.h>
+
+/* Radix-2 complex FFT. Data is interleaved (re, im) pairs, transformed in
+ * place. The inverse is scaled by 1/n so a round trip is the identity. */
+typedef struct {
+    size_t n;
+    int log2n;
+    float *twiddle; /* (cos, -sin) pairs, each stage's in a run of its own. */
+    uint32_t *bitrev;
+} Fft;
+
+bool fft_init(Fft *fft, size_t n);
+void fft_free(Fft *fft);
+
+void fft_forward(Fft *fft, float *data);
+void fft_inverse(Fft *fft, float *data);
+
+#endif /* ALEPH_FFT_H */
@@ -0,0 +1,13 @@
+#ifndef ALEPH_FLAC_H
+#define ALEPH_FLAC_H
+
+#include <aleph/audio_file.h>
+#include <aleph/workers.h>
+
+/* Decodes a whole FLAC stream held in memory into `file`, splitting the
+ * frames across `pool`. Every frame is checked against its CRCs, and the
+ * decode falls back to walking the stream in order if the frames found in
+ * parallel don't chain up. */
+bool flac_decode(Audio_File *file, const uint8_t *data, size_t len, Worker_Pool *pool);
+
+#endif /* ALEPH_FLAC_H */
@@ -3,9 +3,14 @@
 
 #include <aleph/defs.h>
 
+/* Opens the window and GL context. Needs nothing from the audio side, so
+ * it can run while audio_init loads the file. */
 void gui_init();
+/* Call once audio_init has returned. */
+void gui_start();
+void gui_free();
 bool gui_is_running();
 void gui_update();
 void gui_draw();
 
-#endif /* ALEPH_GUI_H */
\ No newline at end of file
+#endif /* ALEPH_GUI_H */
\ No newline at end of file
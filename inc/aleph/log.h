@@ -0,0 +1,18 @@
+#ifndef ALEPH_LOG_H
+#define ALEPH_LOG_H
+
+#include <aleph/defs.h>
+
+/* LOG and friends write fixed-size records into a per-thread ring without
+ * locking or formatting. A background thread started by log_init() merges
+ * the rings in timestamp order and prints them. Until then, and after
+ * log_shutdown(), logging prints directly. */
+void log_init();
+void log_shutdown();
+
+/* Formats and prints everything queued so far on the calling thread. */
+void log_flush();
+
+void log_set_level(Log_Level level);
+
+#endif /* ALEPH_LOG_H */
@@ -0,0 +1,26 @@
+#ifndef ALEPH_LOUDNESS_H
+#define ALEPH_LOUDNESS_H
+
+#include <aleph/audio_file.h>
+
+/* EBU R128 integrated loudness and sample peak of any stretch of a file.
+ * The file is K-weighted once and its power kept per 100 ms block, so a
+ * measurement only gates the 400 ms windows those blocks make up. Stretches
+ * are taken to whole blocks. */
+#define LOUDNESS_GATE_LUFS -70.0f
+
+typedef struct Loudness_Index Loudness_Index;
+
+typedef struct {
+    float lufs; /* LOUDNESS_GATE_LUFS when nothing is loud enough to gate in. */
+    float peak; /* Linear. */
+} Loudness;
+
+/* Built on a thread pool of its own. */
+Loudness_Index *loudness_build(const Audio_File *file);
+void loudness_free(Loudness_Index *index);
+
+/* Frames `start` to `end`, inclusive. */
+Loudness loudness_measure(const Loudness_Index *index, size_t start, size_t end);
+
+#endif /* ALEPH_LOUDNESS_H */
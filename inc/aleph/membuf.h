@@ -2,6 +2,7 @@
 #define ALEPH_MEMBUF_H
 
 #include <aleph/defs.h>
+#include <aleph/alloc.h>
 
 typedef struct {
     const uint8_t *data;
@@ -9,6 +10,9 @@ typedef struct {
 } Membuf;
 
 bool membuf_load(Membuf *buf, const char *path);
+/* Like membuf_load, but the data lives in `arena` and is never freed on its
+ * own. */
+bool membuf_load_arena(Membuf *buf, Arena *arena, const char *path);
 void membuf_free(Membuf *buf);
 
-#endif /* ALEPH_MEMBUF_H */
\ No newline at end of file
+#endif /* ALEPH_MEMBUF_H */
\ No newline at end of file
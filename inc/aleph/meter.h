@@ -0,0 +1,32 @@
+#ifndef ALEPH_METER_H
+#define ALEPH_METER_H
+
+#include <aleph/defs.h>
+
+/* Interpolation taps per phase of the 4x oversampler for true peak. */
+#define METER_TAPS 8
+
+/* What the GUI sees of a stereo signal, in linear amplitude. */
+typedef struct {
+    float peak[2];
+    float rms[2];
+    float true_peak[2];
+    uint32_t clips; /* Blocks that went over full scale. */
+} Meter_Level;
+
+/* Running state, owned by the audio thread. Peaks fall back at a fixed rate
+ * and RMS is averaged over ~300ms, so a reader sampling at frame rate
+ * doesn't miss anything between its reads. */
+typedef struct {
+    float peak[2];
+    float ms[2];
+    float true_peak[2];
+    float hist[(METER_TAPS - 1) * 2];
+    uint32_t clips;
+} Meter;
+
+/* Sets the ballistics for blocks of `block_frames` frames. */
+void meter_setup(int sample_rate, size_t block_frames);
+void meter_process(Meter *meter, const float *data, size_t frames, Meter_Level *out);
+
+#endif /* ALEPH_METER_H */
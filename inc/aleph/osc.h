@@ -0,0 +1,35 @@
+#ifndef ALEPH_OSC_H
+#define ALEPH_OSC_H
+
+#include <aleph/defs.h>
+
+/* Open Sound Control over UDP on localhost, served from a thread of its own
+ * straight into the mixer's command queue. Messages in a bundle land on the
+ * bundle's time tag, in the order given: play, stop and index to the frame,
+ * the rest at the top of the block holding it. Begin is answered as soon as
+ * it arrives, as are messages outside a bundle. Ending a slice, even on a
+ * later tag, stops it taking messages at once.
+ *
+ *   /aleph/slice/begin             i start, i end[, i loop]
+ *                                  replies /aleph/slice/begun i id
+ *   /aleph/slice/end               i id
+ *   /aleph/slice/play              i id
+ *   /aleph/slice/stop              i id
+ *   /aleph/slice/index             i id, i frame
+ *   /aleph/slice/sustain           i id, f level
+ *   /aleph/slice/send              i id, i send
+ *   /aleph/slice/stretch           i id, i mode, f speed
+ *                                  mode 0 off, 1 WSOLA, 2 vocoder
+ *   /aleph/slice/gain              i id, f gain
+ *   /aleph/slice/normalize         i id, f lufs
+ *   /aleph/channel/volume          i chan, f gain
+ *   /aleph/channel/delay_time      i chan, f seconds
+ *   /aleph/channel/delay_feedback  i chan, f amount
+ *
+ * Integer and float arguments are taken for one another, floats only within
+ * range. Messages with arguments of any other type, strings included, are
+ * dropped. */
+bool osc_start(int port);
+void osc_stop();
+
+#endif /* ALEPH_OSC_H */
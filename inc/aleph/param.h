@@ -0,0 +1,51 @@
+#ifndef ALEPH_PARAM_H
+#define ALEPH_PARAM_H
+
+#include <aleph/defs.h>
+
+/* A control value owned by the audio thread. Changes glide to their target
+ * over `smooth_frames` instead of jumping, and an automation lane, once
+ * attached, drives the value on the mixer's frame clock. A param that is
+ * neither gliding nor automated stays a plain float. */
+
+typedef struct {
+    uint64_t frame;
+    float value;
+} Param_Point;
+
+/* Points sorted by frame; the value moves linearly from one to the next and
+ * holds the last one after it. Before the first point the param keeps its
+ * set value. */
+typedef struct {
+    size_t count;
+    size_t cursor;
+    Param_Point points[];
+} Param_Lane;
+
+typedef struct {
+    float value; /* As of the end of the last block rendered. */
+    float target;
+    float step;
+    uint32_t ramp_left;
+    uint32_t smooth_frames;
+    Param_Lane *lane;
+} Param;
+
+void param_init(Param *param, float value, uint32_t smooth_frames);
+
+/* Starts a glide from wherever the param is towards `target`. */
+void param_set(Param *param, float target);
+
+/* Returns the lane that was attached, to be freed off the audio thread. */
+Param_Lane *param_automate(Param *param, Param_Lane *lane);
+
+/* Per frame values for the block starting at mixer frame `time`, written to
+ * `buf`, or NULL when the param holds still at `param->value` the whole
+ * block. Advances the param to the end of the block; call it exactly once a
+ * block. When a lane finishes, it is detached and returned in `done`. */
+const float *param_block(Param *param, uint64_t time, size_t frames, float *buf, Param_Lane **done);
+
+Param_Lane *param_lane_create(const Param_Point *points, size_t count);
+void param_lane_free(Param_Lane *lane);
+
+#endif /* ALEPH_PARAM_H */
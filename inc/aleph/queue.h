@@ -0,0 +1,18 @@
+#ifndef ALEPH_QUEUE_H
+#define ALEPH_QUEUE_H
+
+#include <aleph/defs.h>
+
+/* Bounded lock-free queue of fixed size elements, safe for any number of
+ * producers and consumers. Neither side ever waits: a push to a full queue
+ * or a pop from an empty one just fails. */
+typedef struct Queue Queue;
+
+/* `capacity` is rounded up to a power of two. */
+Queue *queue_create(size_t elem_size, size_t capacity);
+void queue_free(Queue *queue);
+
+bool queue_push(Queue *queue, const void *elem);
+bool queue_pop(Queue *queue, void *elem);
+
+#endif /* ALEPH_QUEUE_H */
@@ -0,0 +1,28 @@
+#ifndef ALEPH_SNAP_H
+#define ALEPH_SNAP_H
+
+#include <aleph/audio_file.h>
+
+/* Where a file's signal crosses zero and how loud it is around there, for
+ * putting slice points where cutting doesn't click. Crossings are taken on
+ * the sum of the channels and stored as the first frame past the crossing. */
+#define SNAP_WINDOW 256
+
+typedef struct Snap_Index Snap_Index;
+
+/* Built on a thread pool of its own. */
+Snap_Index *snap_build(const Audio_File *file);
+void snap_free(Snap_Index *index);
+
+/* The crossing nearest `frame`, or `frame` if there are none. */
+size_t snap_crossing(const Snap_Index *index, size_t frame);
+
+/* Of the crossings within `radius` frames, the one in the quietest window,
+ * the nearer one among equals; `frame` if there are none. Takes log time
+ * however wide the radius. */
+size_t snap_quiet(const Snap_Index *index, size_t frame, size_t radius);
+
+/* RMS over the window holding `frame`, in dBFS, to half a dB. */
+float snap_level_db(const Snap_Index *index, size_t frame);
+
+#endif /* ALEPH_SNAP_H */
@@ -0,0 +1,18 @@
+#ifndef ALEPH_SPECTROGRAM_H
+#define ALEPH_SPECTROGRAM_H
+
+#include <aleph/audio_file.h>
+
+/* Starts the background threads that compute spectrogram tiles for `file`.
+ * The file's data must stay alive until spectrogram_free(). */
+void spectrogram_init(const Audio_File *file);
+void spectrogram_free();
+
+/* Draws `width` pixels starting at pixel `start`, with `zoom` frames per
+ * pixel, between the given GL x/y coordinates. Missing tiles are queued,
+ * visible ones first, and drawn from a coarser level until they are ready.
+ * Must be called from the thread owning the GL context. */
+void spectrogram_draw(size_t start, size_t zoom, size_t width,
+    float x0, float x1, float y0, float y1);
+
+#endif /* ALEPH_SPECTROGRAM_H */
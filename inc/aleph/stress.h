@@ -0,0 +1,14 @@
+#ifndef ALEPH_STRESS_H
+#define ALEPH_STRESS_H
+
+#include <aleph/defs.h>
+
+#define STRESS_STAGE_SECONDS 2.0
+
+/* Load test for the running mixer: plays more and more looping voices at
+ * increasing effect loads, times every block against its deadline and
+ * prints the percentiles and the most each load sustains. Takes over the
+ * slices and sends while it runs. */
+void stress_run(double stage_seconds);
+
+#endif /* ALEPH_STRESS_H */
@@ -0,0 +1,67 @@
+#ifndef ALEPH_STRETCH_H
+#define ALEPH_STRETCH_H
+
+#include <aleph/defs.h>
+
+/* Plays stereo audio back faster or slower without changing its pitch.
+ * WSOLA splices overlapping windows where they line up best, which keeps
+ * drums tight; the phase vocoder runs each partial at its own frequency,
+ * which keeps sustained tones smooth. State is fixed size, so voices live
+ * in a pool like anything else on the audio thread. */
+typedef enum {
+    STRETCH_OFF,
+    STRETCH_WSOLA,
+    STRETCH_VOCODER,
+} Stretch_Mode;
+
+/* Source frames consumed per frame played. */
+#define STRETCH_MIN_SPEED 0.25f
+#define STRETCH_MAX_SPEED 4.0f
+
+#define STRETCH_MAX_WINDOW 2048
+#define STRETCH_MAX_BINS (STRETCH_MAX_WINDOW / 2)
+#define STRETCH_FIFO_FRAMES 4096
+
+typedef struct {
+    const float *data;
+    int nchannels; /* Mono is played on both sides. */
+    size_t start, end; /* Inclusive, as a slice's. */
+    bool loop;
+} Stretch_Source;
+
+typedef struct {
+    Stretch_Mode mode;
+    double pos; /* Source frame the next window starts on. */
+    int64_t last; /* Where the previous one was taken from. */
+    double heard; /* Source frame at the front of the fifo. */
+    bool primed;
+    bool done;
+    size_t skew;
+    size_t skip;
+
+    float ola[STRETCH_MAX_WINDOW * 2];
+    float fifo[STRETCH_FIFO_FRAMES * 2];
+    size_t fifo_read, fifo_count;
+
+    /* Phase vocoder only. */
+    float phase_in[2][STRETCH_MAX_BINS];
+    float phase_out[2][STRETCH_MAX_BINS];
+} Stretch;
+
+void stretch_setup();
+void stretch_shutdown();
+
+/* Starts over from source frame `pos`. A window is synthesized whole, so
+ * voices given different `skew`s, say a block apart, take their turns in
+ * different blocks rather than all at once. */
+void stretch_reset(Stretch *stretch, Stretch_Mode mode, size_t pos, size_t skew);
+
+/* Plays `frames` frames of `src` into `out` at `speed`. Returns fewer once
+ * a one-shot source has run out. */
+size_t stretch_render(Stretch *stretch, const Stretch_Source *src, float speed,
+    float *out, size_t frames);
+
+/* The source frame now coming out. */
+size_t stretch_position(const Stretch *stretch);
+
+#endif /* ALEPH_STRETCH_H */
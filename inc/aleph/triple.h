@@ -0,0 +1,20 @@
+#ifndef ALEPH_TRIPLE_H
+#define ALEPH_TRIPLE_H
+
+#include <aleph/defs.h>
+
+/* Triple buffer for handing snapshots from one writer to one reader without
+ * either ever waiting. The writer fills its back buffer and publishes it;
+ * the reader always gets the most recently published one. */
+typedef struct Triple Triple;
+
+Triple *triple_create(size_t size);
+void triple_free(Triple *triple);
+
+void *triple_back(Triple *triple);
+void triple_publish(Triple *triple);
+
+/* The latest snapshot, valid until the reader's next call. */
+const void *triple_read(Triple *triple);
+
+#endif /* ALEPH_TRIPLE_H */
@@ -0,0 +1,21 @@
+#ifndef ALEPH_WORKERS_H
+#define ALEPH_WORKERS_H
+
+#include <aleph/defs.h>
+
+typedef void (*Work_Fn)(void *ud, size_t index);
+
+typedef struct Worker_Pool Worker_Pool;
+
+/* Passing nthreads <= 0 uses one helper per core, minus the calling thread.
+ * Realtime pools pin their helpers to cores, raise their priority and keep
+ * spinning between runs for a bounded time before going to sleep. */
+Worker_Pool *workers_create(int nthreads, bool realtime);
+void workers_free(Worker_Pool *pool);
+int workers_count(Worker_Pool *pool);
+
+/* Calls fn(ud, i) for every i in [0, count), returning once all calls are
+ * done. The calling thread takes part in the work. */
+void workers_run(Worker_Pool *pool, size_t count, Work_Fn fn, void *ud);
+
+#endif /* ALEPH_WORKERS_H */
@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include <aleph/alloc.h>
+
+static THREAD_LOCAL bool realtime_thread = false;
+
+static size_t align_up(size_t size, size_t align);
+
+void arena_init(Arena *arena, size_t block_size) {
+    arena->first = NULL;
+    arena->cur = NULL;
+    arena->block_size = block_size;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size, ARENA_ALIGN);
+
+    Arena_Block *block = arena->cur;
+    while (block && block->used + size > block->size) {
+        block = block->next;
+    }
+
+    if (!block) {
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        size_t header = align_up(sizeof(Arena_Block), ARENA_ALIGN);
+        block = (Arena_Block *) NEW_ARR(uint8_t, header + block_size);
+        block->size = block_size;
+        block->used = 0;
+        block->next = NULL;
+
+        if (!arena->first) {
+            arena->first = block;
+        } else {
+            Arena_Block *last = arena->cur ? arena->cur : arena->first;
+            while (last->next) {
+                last = last->next;
+            }
+            last->next = block;
+        }
+    }
+
+    arena->cur = block;
+
+    uint8_t *ptr = ((uint8_t *) block) + align_up(sizeof(Arena_Block), ARENA_ALIGN) + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void arena_reset(Arena *arena) {
+    for (Arena_Block *block = arena->first; block; block = block->next) {
+        block->used = 0;
+    }
+
+    arena->cur = arena->first;
+}
+
+void arena_free(Arena *arena) {
+    Arena_Block *block = arena->first;
+    while (block) {
+        Arena_Block *next = block->next;
+        FREE(block);
+        block = next;
+    }
+
+    arena->first = NULL;
+    arena->cur = NULL;
+}
+
+void pool_init(Pool *pool, size_t elem_size, size_t count) {
+    pool->elem_size = align_up(elem_size < sizeof(void *) ? sizeof(void *) : elem_size, ARENA_ALIGN);
+    pool->count = count;
+    pool->data = NEW_ARR(uint8_t, pool->elem_size * count);
+    pool->free_list = NULL;
+
+    /* Thread the list backwards so the first get returns element 0. */
+    for (size_t i = count; i > 0; i--) {
+        void **elem = (void **) (pool->data + (i - 1) * pool->elem_size);
+        *elem = pool->free_list;
+        pool->free_list = elem;
+    }
+}
+
+void *pool_get(Pool *pool) {
+    void **elem = (void **) pool->free_list;
+    if (!elem) {
+        return NULL;
+    }
+
+    pool->free_list = *elem;
+    memset(elem, 0, pool->elem_size);
+
+    return elem;
+}
+
+void pool_put(Pool *pool, void *ptr) {
+    void **elem = (void **) ptr;
+    *elem = pool->free_list;
+    pool->free_list = elem;
+}
+
+size_t pool_index(Pool *pool, const void *ptr) {
+    return (((const uint8_t *) ptr) - pool->data) / pool->elem_size;
+}
+
+void *pool_at(Pool *pool, size_t index) {
+    return pool->data + index * pool->elem_size;
+}
+
+void pool_free(Pool *pool) {
+    FREE(pool->data);
+    pool->data = NULL;
+    pool->free_list = NULL;
+}
+
+void alloc_set_realtime(bool realtime) {
+    realtime_thread = realtime;
+}
+
+#ifdef ALEPH_DEBUG_ALLOC
+
+void *_alloc_checked(size_t count, size_t size, const char *file, int line) {
+    if (realtime_thread) {
+        _fail("allocation on a realtime thread", file, line);
+    }
+
+    return calloc(count, size);
+}
+
+void _free_checked(void *ptr, const char *file, int line) {
+    if (realtime_thread) {
+        _fail("free on a realtime thread", file, line);
+    }
+
+    free(ptr);
+}
+
+#endif
+
+static size_t align_up(size_t size, size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
@@ -1,12 +1,29 @@
+#include <stdio.h>
+#include <math.h>
+
 #include <SDL.h>
 
-#include <portaudio.h>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define AUDIO_SSE
+#endif
 
 #include <aleph/defs.h>
+#include <aleph/alloc.h>
 #include <aleph/audio.h>
+#include <aleph/audio_backend.h>
 #include <aleph/audio_file.h>
-
-#define SAMPLE_RATE 44100
+#include <aleph/conv.h>
+#include <aleph/loudness.h>
+#include <aleph/meter.h>
+#include <aleph/param.h>
+#include <aleph/queue.h>
+#include <aleph/snap.h>
+#include <aleph/stretch.h>
+#include <aleph/triple.h>
+#include <aleph/workers.h>
+
+#define SAMPLE_RATE AUDIO_SAMPLE_RATE
 #define FRAMES_PER_BUFFER 64
 #define SAMPLES_PER_BUFFER (FRAMES_PER_BUFFER * 2)
 
@@ -25,160 +42,801 @@ typedef struct Slice {
     bool playing;
 
     size_t a, d, r;
-    float s;
+    Param sustain;
     ADSR_State adsr;
     size_t adsr_index;
+    float level; /* The envelope as of the last frame. */
+    float release_from;
+
+    /* Frames into the next block a play or stop lands on. */
+    unsigned long play_at, stop_at;
+
+    /* Source frames per frame played, when stretching. The stretcher's
+     * state is large and kept apart, in `stretches` by Slice_Id. */
+    float speed;
+    Stretch_Mode stretch;
+
+    float gain; /* Rides along with the envelope. */
 } Slice;
 
+#define NO_STOP ((unsigned long) -1)
+
+/* Normalizing lifts a slice by at most 24 dB and keeps its peak a dB under
+ * full scale. */
+#define NORMALIZE_MAX_GAIN 15.85f
+#define NORMALIZE_PEAK 0.891f
+
+/* The shapes an envelope takes over a run of frames, gain and all: a line,
+ * the sustain lane as it glides, or the decay towards it as it does. */
+typedef enum {
+    ENV_LINE,
+    ENV_SUSTAIN,
+    ENV_DECAY,
+    ENV_SHAPES,
+} Env_Shape;
+
+typedef struct {
+    Env_Shape shape;
+    float from, step; /* The line; for ENV_DECAY, how far down it is. */
+    const float *sustain; /* From the run's first frame. */
+    float gain;
+} Env_Span;
+
+typedef void (*Voice_Kernel)(float *restrict out, const float *restrict src, const Env_Span *env, int frames);
+
+/* Voices are mixed a run at a time by a kernel made for the run's envelope
+ * shape and the source's channel count, so the loop has nothing to decide
+ * and vectorizes. A mono source goes to both sides. */
+#define VOICE_KERNEL(_name, _nchannels, _scale) \
+    static void _name(float *restrict out, const float *restrict src, const Env_Span *env, int frames) { \
+        for (int i = 0; i < frames; i++) { \
+            float scale = (_scale); \
+            out[i * 2] += src[i * (_nchannels)] * scale; \
+            out[i * 2 + 1] += src[i * (_nchannels) + (_nchannels) - 1] * scale; \
+        } \
+    }
+
+VOICE_KERNEL(voice_line_mono, 1, env->from + env->step * i)
+VOICE_KERNEL(voice_line_stereo, 2, env->from + env->step * i)
+VOICE_KERNEL(voice_sustain_mono, 1, env->sustain[i] * env->gain)
+VOICE_KERNEL(voice_sustain_stereo, 2, env->sustain[i] * env->gain)
+VOICE_KERNEL(voice_decay_mono, 1, (1.0f - (1.0f - env->sustain[i]) * (env->from + env->step * i)) * env->gain)
+VOICE_KERNEL(voice_decay_stereo, 2, (1.0f - (1.0f - env->sustain[i]) * (env->from + env->step * i)) * env->gain)
+
+static const Voice_Kernel voice_kernels[ENV_SHAPES][2] = {
+    [ENV_LINE] = {voice_line_mono, voice_line_stereo},
+    [ENV_SUSTAIN] = {voice_sustain_mono, voice_sustain_stereo},
+    [ENV_DECAY] = {voice_decay_mono, voice_decay_stereo},
+};
+
+/* Slice points are meant to sit on zero crossings, so the envelope only has
+ * to round off what is left. */
+#define SLICE_FADE_FRAMES (SAMPLE_RATE / 200)
+
 #define MAX_DELAY_SECONDS 5
-#define MAX_DELAY_SAMPLES ((SAMPLE_RATE * 2) * MAX_DELAY_SECONDS)
+#define MAX_DELAY_FRAMES (SAMPLE_RATE * MAX_DELAY_SECONDS)
+
+/* How long set values take to arrive. Delay time glides slower since moving
+ * it bends the pitch of what is in the line. */
+#define SMOOTH_FRAMES (SAMPLE_RATE / 100)
+#define DELAY_SMOOTH_FRAMES (SAMPLE_RATE / 20)
+
+#define COMMAND_QUEUE_SIZE 1024
+
+/* Commands stamped for a later block wait here. */
+#define MAX_PENDING 256
+
+/* Export renders in blocks the size of the mixer's and writes them out in
+ * chunks. After the slice ends its effects ring out until the output has
+ * been this quiet for a while, past any echo still due. */
+#define EXPORT_CHUNK_FRAMES 4096
+#define EXPORT_MAX_TAIL_SECONDS 10
+#define EXPORT_SILENCE 0.00003f
+#define EXPORT_SILENT_FRAMES (SAMPLE_RATE / 10)
+
+typedef enum {
+    TIMING_IDLE,
+    TIMING_RUNNING,
+    TIMING_STOPPING,
+} Timing_State;
 
 typedef struct {
     int output; /* Index of the its output channel. -1 for direct output. */
     float data[SAMPLES_PER_BUFFER];
-    float delay_data[MAX_DELAY_SAMPLES];
-    size_t delay_idx, delay_len;
-    size_t data_idx;
-    float delay_damp;
+    float delay_data[MAX_DELAY_FRAMES * 2];
+    size_t delay_pos;
+
+    Param params[AUDIO_PARAM_COUNT];
+
+    Meter meter;
+
+    /* Sends only. The mixer owns `conv`; replacements are handed over
+     * through `conv_next` and the old one handed back through `conv_dead`. */
+    Conv *conv;
+    void *conv_next;
+    void *conv_dead;
+    float conv_mix;
 } Channel;
 
-#define MAX_SLICES 64
+typedef enum {
+    COMMAND_NONE, /* What held commands for a slice become once it ends. */
+    COMMAND_PARAM_SET,
+    COMMAND_PARAM_AUTOMATE,
+    COMMAND_SLICE_BEGIN,
+    COMMAND_SLICE_END,
+    COMMAND_SLICE_SEND,
+    COMMAND_SLICE_PLAY,
+    COMMAND_SLICE_STOP,
+    COMMAND_SLICE_SET_INDEX,
+    COMMAND_SLICE_STRETCH,
+    COMMAND_SLICE_GAIN,
+} Command_Type;
+
+/* Control threads never touch a Param or a slice's playback; they queue one
+ * of these for the mixer, which applies it on its frame, and it hands
+ * finished lanes and ended slices back through the trash queue. Commands for
+ * a slice the mixer doesn't have are dropped. */
+typedef struct {
+    Command_Type type;
+    uint64_t frame; /* Mixer frame it takes effect on; 0 for right away. */
+    Param *param;
+    Param_Lane *lane;
+    Slice *slice;
+    float value;
+    size_t index;
+    int output;
+    Stretch_Mode stretch;
+} Audio_Command;
+
+/* One of the two, to be freed or put back off the audio thread. */
+typedef struct {
+    Param_Lane *lane;
+    Slice *slice;
+} Audio_Trash;
+
+/* One channel on an export's path out, with its settings frozen. */
+typedef struct {
+    Conv *conv;
+    float conv_mix;
+    float volume;
+    bool delay;
+    float delay_time, delay_feedback;
+} Export_Stage;
 
-#define NUM_SENDS 10
+typedef struct {
+    Slice slice;
+    Export_Stage stages[1 + AUDIO_NUM_SENDS];
+    int nstages;
+    char path[1024];
+    bool ok;
+} Export_Job;
+
+#define MAX_SLICES AUDIO_MAX_SLICES
+#define NUM_SENDS AUDIO_NUM_SENDS
+#define NUM_CHANNELS AUDIO_NUM_CHANNELS
+
+/* Stands in for "no reverb" in conv_next, where NULL means nothing pending. */
+static char conv_off;
+#define CONV_OFF ((void *) &conv_off)
 
-#define NUM_CHANNELS (MAX_SLICES + NUM_SENDS)
+/* Below this many playing slices the wake-up cost outweighs the rendering. */
+#define PARALLEL_MIN_SLICES 4
 
 struct {
-    bool ready, stop, has_stopped;
-    PaStream *stream;
+    const Audio_Backend *backend;
     Audio_File file;
-    SDL_Thread *thread;
+    Snap_Index *snap;
+    Loudness_Index *loudness;
+    Conv *reverb; /* Loaded, not yet handed to its send. */
     size_t repeat_start, repeat_end;
-    Slice slices[MAX_SLICES];
-    Slice *cur_slice, *free_slice;
+    Pool slice_pool;
+    Slice *cur_slice; /* The mixer's own, linked and unlinked by commands. */
+    Stretch *stretches;
 
     Channel chans[NUM_CHANNELS];
+    int slice_output; /* Where new slices' channels go. */
+    float wet[SAMPLES_PER_BUFFER];
+
+    Meter master_meter;
+    Triple *meters; /* Audio_Meters, published every block. */
+
+    Queue *commands;
+    Queue *trash;
+    Audio_Command pending[MAX_PENDING];
+    size_t npending;
+
+    /* Serializes slice begin and end between control threads, and guards
+     * `begun` and `nending`: slices begun and not ended, and ended slices
+     * the mixer has yet to hand back. */
+    SDL_mutex *slice_lock;
+    bool begun[MAX_SLICES];
+    int nending;
+    bool mixed[MAX_SLICES]; /* The mixer's view. */
+
+    /* Held across a reverb handover, so exports can clone a send's `conv`
+     * without the mixer swapping it out and the old one being freed. */
+    SDL_mutex *conv_lock;
+
+    /* The mixer only writes `timing` while RUNNING. */
+    SDL_atomic_t timing_state;
+    Audio_Timing timing;
+    double ticks_per_us;
+
+    Worker_Pool *pool;
+    Slice *active[MAX_SLICES];
+    unsigned long block_frames;
+    uint64_t block_time;
+    uint64_t max_frames;
+
+    /* Only written by the audio thread. */
+    volatile uint64_t frames;
 } audio_sys;
 
-static int audio_thread_callback(void *ud);
-static void channel_get_samples(Channel *chan, float *l, float *r);
-static float get_adsr_scale(Slice *slice);
-static int pa_callback(const void *in_buf, void *out_buf, 
-    unsigned long frames_per_buffer, const PaStreamCallbackTimeInfo *time_info, 
-    PaStreamCallbackFlags status_flags, void *ud);
-static void pa_finished_callback(void *ud);
+static void channel_delay(Channel *chan, unsigned long frames);
+static void delay_process(float *line, size_t *pos, float *data, unsigned long frames,
+    const float *time, float time_fixed, const float *feedback, float feedback_fixed);
+static void channel_params_init(Param *params);
+static void export_job_init(Export_Job *job, const Slice *slice, const Param *params, int output);
+static size_t export_run(Export_Job *jobs, size_t count);
+static void export_task(void *ud, size_t index);
+static bool export_render(Export_Job *job);
+static void slice_defaults(Slice *slice, size_t start, size_t end, bool loop);
+static void slice_restart(Slice *slice, Stretch_Mode mode);
+static void voice_render(Slice *slice, Stretch *stretch, const float *sustain, float *out, unsigned long frames);
+static bool envelope_span(Slice *slice, const float *sustain, unsigned long *frames, Env_Span *env);
+static void channel_volume(Channel *chan, unsigned long frames);
+static const float *block_param(Param *param, float *buf);
+static void scale_frames(float *data, const float *gain, float constant, unsigned long frames);
+static void command_send(const Audio_Command *cmd);
+static void commands_receive(unsigned long frames);
+static void command_apply(const Audio_Command *cmd);
+static bool command_stale(const Audio_Command *cmd);
+static void slice_unlink(Slice *slice);
+static void collect_trash();
+static void send_set_conv(int send, Conv *conv, float mix);
+static void timing_record(Uint64 start);
+static void audio_mix(float *out, unsigned long frames);
+static void slice_render(Slice *slice, Channel *chan, unsigned long frames);
+static void slice_render_task(void *ud, size_t index);
+static void send_process(Channel *chan, unsigned long frames);
+
+void audio_init(const Audio_Config *config) {
+    audio_load(config);
+    audio_start(config);
+}
+
+void audio_load(const Audio_Config *config) {
+    const char *path = config->path ? config->path : "test.wav";
+    if (!audio_file_load(&audio_sys.file, path)) {
+        FAIL_FMT("failed to open audio file: '%s'", path);
+    }
+    if (audio_sys.file.nchannels > 2) {
+        FAIL_FMT("'%s' has %d channels; only mono and stereo play", path, audio_sys.file.nchannels);
+    }
+
+    audio_sys.snap = snap_build(&audio_sys.file);
+    audio_sys.loudness = loudness_build(&audio_sys.file);
 
-void audio_init() {
-    if (!audio_file_load_wav(&audio_sys.file, "test.wav")) {
-        FAIL("failed to open audio file: 'test.wav'");
+    if (config->reverb) {
+        audio_sys.reverb = conv_load(config->reverb, SAMPLE_RATE, 1.0f);
+        if (!audio_sys.reverb) {
+            FAIL_FMT("failed to load impulse response: '%s'", config->reverb);
+        }
     }
+}
 
-    Slice *free_slices = NULL;
+void audio_start(const Audio_Config *config) {
+    /* Slice_Ids are pool indices and double as the slice's channel. */
+    pool_init(&audio_sys.slice_pool, sizeof(Slice), MAX_SLICES);
+    audio_sys.stretches = NEW_ARR(Stretch, MAX_SLICES);
+
+    audio_sys.commands = queue_create(sizeof(Audio_Command), COMMAND_QUEUE_SIZE);
+    audio_sys.trash = queue_create(sizeof(Audio_Trash), COMMAND_QUEUE_SIZE);
+    audio_sys.npending = 0;
+    audio_sys.slice_lock = SDL_CreateMutex();
+    audio_sys.conv_lock = SDL_CreateMutex();
+    audio_sys.nending = 0;
     for (int i = 0; i < MAX_SLICES; i++) {
-        audio_sys.slices[i].next = free_slices;
-        free_slices = &audio_sys.slices[i];
+        audio_sys.begun[i] = false;
+        audio_sys.mixed[i] = false;
     }
 
     for (int i = 0; i < NUM_CHANNELS; i++) {
         Channel *chan = &audio_sys.chans[i];
         chan->output = -1;
-        chan->data_idx = 0;
-        chan->delay_damp = 0.2;
         memset(chan->delay_data, 0, sizeof(chan->delay_data));
-        chan->delay_len = ((float) SAMPLE_RATE) / 2; 
+        chan->delay_pos = 0;
+        channel_params_init(chan->params);
     }
 
-    audio_sys.free_slice = free_slices;
     audio_sys.cur_slice = NULL;
+    audio_sys.slice_output = -1;
+
+    if (audio_sys.reverb) {
+        Channel *send = &audio_sys.chans[MAX_SLICES];
+        send->conv = audio_sys.reverb;
+        send->conv_mix = config->reverb_mix;
+        audio_sys.slice_output = MAX_SLICES;
+        audio_sys.reverb = NULL;
+    }
 
     audio_sys.repeat_start = 0;
     audio_sys.repeat_end = audio_sys.file.len;
 
-    audio_sys.ready = false;
-    audio_sys.stop = false;
-    audio_sys.thread = SDL_CreateThread(audio_thread_callback, "audio", NULL);
+    meter_setup(SAMPLE_RATE, FRAMES_PER_BUFFER);
+    stretch_setup();
+    audio_sys.meters = triple_create(sizeof(Audio_Meters));
+
+    audio_sys.pool = workers_create(0, true);
+    audio_sys.frames = 0;
 
-    while (!audio_sys.ready) {
-        SDL_Delay(100);
+    SDL_AtomicSet(&audio_sys.timing_state, TIMING_IDLE);
+    audio_sys.ticks_per_us = SDL_GetPerformanceFrequency() / 1e6;
+    audio_sys.timing.deadline_us = FRAMES_PER_BUFFER * 1e6 / SAMPLE_RATE;
+    audio_sys.timing.bucket_us = audio_sys.timing.deadline_us * 4 / AUDIO_TIMING_BUCKETS;
+
+    const char *backend = config->backend ? config->backend : "portaudio";
+    audio_sys.backend = audio_backend_find(backend);
+    if (!audio_sys.backend) {
+        FAIL_FMT("unknown audio backend: '%s'", backend);
+    }
+
+    Audio_Backend_Config backend_config = {
+        .sample_rate = SAMPLE_RATE,
+        .frames_per_buffer = FRAMES_PER_BUFFER,
+        .realtime = !config->fast,
+        .path = config->out_path,
+        .max_frames = (uint64_t) (config->seconds * SAMPLE_RATE + 0.5),
+    };
+    audio_sys.max_frames = backend_config.max_frames;
+
+    if (!audio_sys.backend->start(&backend_config, audio_mix)) {
+        FAIL_FMT("failed to start audio backend '%s'", backend);
     }
 
-    LOG("audio thread launched");
+    LOG_FMT("audio backend '%s' started", backend);
 }
 
 void audio_stop() {
-    audio_sys.has_stopped = false;
-    audio_sys.stop = true;
-    while (!audio_sys.has_stopped) {
-        SDL_Delay(100);
-    }
+    audio_sys.backend->stop();
 
-    LOG("audio thread stopped");
+    workers_free(audio_sys.pool);
+    audio_sys.pool = NULL;
 
+    triple_free(audio_sys.meters);
+    audio_sys.meters = NULL;
+
+    snap_free(audio_sys.snap);
+    audio_sys.snap = NULL;
+
+    loudness_free(audio_sys.loudness);
+    audio_sys.loudness = NULL;
+
+    stretch_shutdown();
+    FREE(audio_sys.stretches);
+    audio_sys.stretches = NULL;
+
+    commands_receive(0);
+    collect_trash();
+    queue_free(audio_sys.commands);
+    queue_free(audio_sys.trash);
+    SDL_DestroyMutex(audio_sys.slice_lock);
+    SDL_DestroyMutex(audio_sys.conv_lock);
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        Channel *chan = &audio_sys.chans[i];
+        for (int p = 0; p < AUDIO_PARAM_COUNT; p++) {
+            param_lane_free(param_automate(&chan->params[p], NULL));
+        }
+
+        if (chan->conv) {
+            conv_free(chan->conv);
+            chan->conv = NULL;
+        }
+    }
+
+    LOG("audio backend stopped");
 }
 
 Slice_Id audio_slice_begin(size_t start, size_t end, bool loop) {
-    Slice *next = audio_sys.free_slice;
-    if (!next) {
+    Slice_Id id = audio_slice_try_begin(start, end, loop);
+    if (id < 0) {
         FAIL("max slices reached");
     }
 
-    next->playing = false;
-    next->start = start;
-    next->end = end;
-    next->loop = loop;
-    audio_sys.free_slice = next->next;
-    next->next = audio_sys.cur_slice;
-    audio_sys.cur_slice = next;
-    next->index = start;
-    next->a = SAMPLE_RATE / 2;
-    next->d = 0;
-    next->s = 1.0f;
-    next->r = SAMPLE_RATE / 2;
+    return id;
+}
+
+/* A slot only comes back once the mixer has let go of it, so with none
+ * free but some ending this waits the block or so that takes. */
+Slice_Id audio_slice_try_begin(size_t start, size_t end, bool loop) {
+    Slice *next;
+    for (;;) {
+        collect_trash();
+        SDL_LockMutex(audio_sys.slice_lock);
+        next = pool_get(&audio_sys.slice_pool);
+        if (next || audio_sys.nending == 0) {
+            break;
+        }
+        SDL_UnlockMutex(audio_sys.slice_lock);
+        SDL_Delay(1);
+    }
+
+    if (!next) {
+        SDL_UnlockMutex(audio_sys.slice_lock);
+        return -1;
+    }
 
+    slice_defaults(next, start, end, loop);
+    Slice_Id id = pool_index(&audio_sys.slice_pool, next);
+    audio_sys.begun[id] = true;
+    SDL_UnlockMutex(audio_sys.slice_lock);
 
-    return next - audio_sys.slices;
+    Audio_Command cmd = {
+        .type = COMMAND_SLICE_BEGIN,
+        .slice = next,
+        .output = audio_sys.slice_output,
+    };
+    command_send(&cmd);
+    return id;
 }
 
 void audio_slice_end(Slice_Id id) {
-    Slice *iter = audio_sys.cur_slice;
-    if ((iter - audio_sys.slices) == id) {
-        Slice *killed_slice = iter;
-        audio_sys.cur_slice = iter->next;
-        killed_slice = audio_sys.free_slice;
-        audio_sys.free_slice = killed_slice;
-        return;
-    }
+    audio_slice_end_at(id, 0);
+}
 
-    while (iter && (iter->next - audio_sys.slices) != id) {
-        iter = iter->next;
+void audio_slice_end_at(Slice_Id id, uint64_t frame) {
+    SDL_LockMutex(audio_sys.slice_lock);
+    if (!audio_sys.begun[id]) {
+        FAIL("slice killed twice");
     }
+    audio_sys.begun[id] = false;
+    audio_sys.nending++;
+    SDL_UnlockMutex(audio_sys.slice_lock);
+
+    Audio_Command cmd = {
+        .type = COMMAND_SLICE_END,
+        .frame = frame,
+        .slice = pool_at(&audio_sys.slice_pool, id),
+    };
+    command_send(&cmd);
+}
 
-    if (!iter) {
-        FAIL("slice killed twice");
-    } else {
-        Slice *killed_slice = iter->next;
-        iter->next = iter->next->next;
-        killed_slice = audio_sys.free_slice;
-        audio_sys.free_slice = killed_slice;
+bool audio_slice_live(Slice_Id id) {
+    if (id < 0 || id >= MAX_SLICES) {
+        return false;
     }
+
+    SDL_LockMutex(audio_sys.slice_lock);
+    bool live = audio_sys.begun[id];
+    SDL_UnlockMutex(audio_sys.slice_lock);
+
+    return live;
 }
 
 void audio_slice_play(Slice_Id id) {
-    Slice *slice = &audio_sys.slices[id];
-    slice->playing = true;
-    slice->adsr = ADSR_RISING;
-    slice->adsr_index = 0;
+    audio_slice_play_at(id, 0);
 }
 
 void audio_slice_stop(Slice_Id id) {
-    Slice *slice = &audio_sys.slices[id];
-    slice->adsr = ADSR_RELEASED;
-    slice->adsr_index = 0;
+    audio_slice_stop_at(id, 0);
 }
 
 void audio_slice_set_index(Slice_Id id, size_t index) {
-    Slice *slice = &audio_sys.slices[id];
-    slice->index = slice->start + index;
+    audio_slice_set_index_at(id, index, 0);
+}
+
+void audio_slice_play_at(Slice_Id id, uint64_t frame) {
+    Audio_Command cmd = {
+        .type = COMMAND_SLICE_PLAY,
+        .frame = frame,
+        .slice = pool_at(&audio_sys.slice_pool, id),
+    };
+    command_send(&cmd);
+}
+
+void audio_slice_stop_at(Slice_Id id, uint64_t frame) {
+    Audio_Command cmd = {
+        .type = COMMAND_SLICE_STOP,
+        .frame = frame,
+        .slice = pool_at(&audio_sys.slice_pool, id),
+    };
+    command_send(&cmd);
+}
+
+void audio_slice_set_index_at(Slice_Id id, size_t index, uint64_t frame) {
+    Audio_Command cmd = {
+        .type = COMMAND_SLICE_SET_INDEX,
+        .frame = frame,
+        .slice = pool_at(&audio_sys.slice_pool, id),
+        .index = index,
+    };
+    command_send(&cmd);
+}
+
+void audio_slice_set_stretch(Slice_Id id, Stretch_Mode mode, float speed) {
+    audio_slice_set_stretch_at(id, mode, speed, 0);
+}
+
+void audio_slice_set_stretch_at(Slice_Id id, Stretch_Mode mode, float speed, uint64_t frame) {
+    Audio_Command cmd = {
+        .type = COMMAND_SLICE_STRETCH,
+        .frame = frame,
+        .slice = pool_at(&audio_sys.slice_pool, id),
+        .stretch = mode,
+        .value = speed < STRETCH_MIN_SPEED ? STRETCH_MIN_SPEED
+            : (speed > STRETCH_MAX_SPEED ? STRETCH_MAX_SPEED : speed),
+    };
+    command_send(&cmd);
+}
+
+void audio_slice_set_gain(Slice_Id id, float gain) {
+    audio_slice_set_gain_at(id, gain, 0);
+}
+
+void audio_slice_set_gain_at(Slice_Id id, float gain, uint64_t frame) {
+    Audio_Command cmd = {
+        .type = COMMAND_SLICE_GAIN,
+        .frame = frame,
+        .slice = pool_at(&audio_sys.slice_pool, id),
+        .value = gain,
+    };
+    command_send(&cmd);
+}
+
+float audio_slice_normalize(Slice_Id id, float lufs) {
+    return audio_slice_normalize_at(id, lufs, 0);
+}
+
+float audio_slice_normalize_at(Slice_Id id, float lufs, uint64_t frame) {
+    SDL_LockMutex(audio_sys.slice_lock);
+    if (!audio_sys.begun[id]) {
+        SDL_UnlockMutex(audio_sys.slice_lock);
+        return 0.0f;
+    }
+    Slice *slice = pool_at(&audio_sys.slice_pool, id);
+    Loudness loudness = loudness_measure(audio_sys.loudness, slice->start, slice->end);
+    SDL_UnlockMutex(audio_sys.slice_lock);
+
+    float gain = 1.0f;
+    if (loudness.lufs > LOUDNESS_GATE_LUFS) {
+        gain = powf(10.0f, (lufs - loudness.lufs) / 20.0f);
+        if (gain > NORMALIZE_MAX_GAIN) {
+            gain = NORMALIZE_MAX_GAIN;
+        }
+        if (loudness.peak * gain > NORMALIZE_PEAK) {
+            gain = NORMALIZE_PEAK / loudness.peak;
+        }
+    }
+
+    audio_slice_set_gain_at(id, gain, frame);
+    return gain;
+}
+
+void audio_slice_set_send(Slice_Id id, int send) {
+    audio_slice_set_send_at(id, send, 0);
+}
+
+void audio_slice_set_send_at(Slice_Id id, int send, uint64_t frame) {
+    if (send >= NUM_SENDS) {
+        FAIL_FMT("no send %d", send);
+    }
+
+    Audio_Command cmd = {
+        .type = COMMAND_SLICE_SEND,
+        .frame = frame,
+        .slice = pool_at(&audio_sys.slice_pool, id),
+        .output = send < 0 ? -1 : MAX_SLICES + send,
+    };
+    command_send(&cmd);
+}
+
+void audio_slice_set_sustain(Slice_Id id, float level) {
+    audio_slice_set_sustain_at(id, level, 0);
+}
+
+void audio_slice_set_sustain_at(Slice_Id id, float level, uint64_t frame) {
+    Slice *slice = pool_at(&audio_sys.slice_pool, id);
+    Audio_Command cmd = {
+        .type = COMMAND_PARAM_SET,
+        .frame = frame,
+        .param = &slice->sustain,
+        .slice = slice,
+        .value = level < 0.0f ? 0.0f : (level > 1.0f ? 1.0f : level),
+    };
+    command_send(&cmd);
+}
+
+/* Maps API values onto what the mixer works in and keeps them in range. */
+static float param_value(Audio_Param param, float value) {
+    float min, max;
+    switch (param) {
+        case AUDIO_PARAM_VOLUME:
+            min = 0.0f;
+            max = 4.0f;
+            break;
+        case AUDIO_PARAM_DELAY_TIME:
+            value *= SAMPLE_RATE;
+            min = 1.0f;
+            max = MAX_DELAY_FRAMES - 2;
+            break;
+        case AUDIO_PARAM_DELAY_FEEDBACK:
+            min = 0.0f;
+            max = 0.99f;
+            break;
+        default:
+            FAIL_FMT("no audio param %d", param);
+    }
+
+    return value < min ? min : (value > max ? max : value);
+}
+
+void audio_channel_set(int chan, Audio_Param param, float value) {
+    audio_channel_set_at(chan, param, value, 0);
+}
+
+void audio_channel_set_at(int chan, Audio_Param param, float value, uint64_t frame) {
+    if (chan < 0 || chan >= NUM_CHANNELS) {
+        FAIL_FMT("no channel %d", chan);
+    }
+
+    Audio_Command cmd = {
+        .type = COMMAND_PARAM_SET,
+        .frame = frame,
+        .param = &audio_sys.chans[chan].params[param],
+        .value = param_value(param, value),
+    };
+    command_send(&cmd);
+}
+
+void audio_channel_automate(int chan, Audio_Param param, const Param_Point *points, size_t count) {
+    if (chan < 0 || chan >= NUM_CHANNELS) {
+        FAIL_FMT("no channel %d", chan);
+    }
+
+    Param_Lane *lane = param_lane_create(points, count);
+    for (size_t i = 0; i < count; i++) {
+        lane->points[i].value = param_value(param, lane->points[i].value);
+    }
+
+    Audio_Command cmd = {
+        .type = COMMAND_PARAM_AUTOMATE,
+        .param = &audio_sys.chans[chan].params[param],
+        .lane = lane,
+    };
+    command_send(&cmd);
+}
+
+bool audio_send_set_reverb(int send, const char *path, float mix) {
+    if (send < 0 || send >= NUM_SENDS) {
+        FAIL_FMT("no send %d", send);
+    }
+
+    Conv *conv = NULL;
+    if (path) {
+        conv = conv_load(path, SAMPLE_RATE, 1.0f);
+        if (!conv) {
+            return false;
+        }
+    }
+
+    send_set_conv(send, conv, mix);
+    return true;
+}
+
+void audio_send_set_impulse(int send, const float *ir, size_t frames, int nchannels, float mix) {
+    if (send < 0 || send >= NUM_SENDS) {
+        FAIL_FMT("no send %d", send);
+    }
+
+    send_set_conv(send, conv_create(ir, frames, nchannels, 1.0f), mix);
+}
+
+void audio_send_set_output(int send, int output) {
+    if (send < 0 || send >= NUM_SENDS || output >= NUM_SENDS || (output >= 0 && output <= send)) {
+        FAIL_FMT("cannot route send %d to %d", send, output);
+    }
+
+    audio_sys.chans[MAX_SLICES + send].output = output < 0 ? -1 : MAX_SLICES + output;
+}
+
+void audio_timing_start() {
+    if (SDL_AtomicGet(&audio_sys.timing_state) != TIMING_IDLE) {
+        FAIL("block timing already running");
+    }
+
+    Audio_Timing *timing = &audio_sys.timing;
+    timing->blocks = 0;
+    timing->late = 0;
+    timing->max_us = 0.0;
+    memset(timing->counts, 0, sizeof(timing->counts));
+    SDL_AtomicSet(&audio_sys.timing_state, TIMING_RUNNING);
+}
+
+const Audio_Timing *audio_timing_stop() {
+    SDL_AtomicSet(&audio_sys.timing_state, TIMING_STOPPING);
+    while (SDL_AtomicGet(&audio_sys.timing_state) != TIMING_IDLE) {
+        SDL_Delay(1);
+    }
+
+    return &audio_sys.timing;
+}
+
+static void send_set_conv(int send, Conv *conv, float mix) {
+    Channel *chan = &audio_sys.chans[MAX_SLICES + send];
+    SDL_LockMutex(audio_sys.conv_lock);
+    chan->conv_mix = mix;
+
+    /* Hand the new state over and wait a block for the mixer to take it,
+     * so the one it replaced can be freed here rather than on the audio
+     * thread. */
+    SDL_AtomicSetPtr(&chan->conv_next, conv ? conv : CONV_OFF);
+    while (SDL_AtomicGetPtr(&chan->conv_next)) {
+        SDL_Delay(1);
+    }
+
+    Conv *old = SDL_AtomicSetPtr(&chan->conv_dead, NULL);
+    SDL_UnlockMutex(audio_sys.conv_lock);
+    if (old) {
+        conv_free(old);
+    }
+}
+
+size_t audio_export(const Audio_Export *exports, size_t count) {
+    Param params[AUDIO_PARAM_COUNT];
+    channel_params_init(params);
+
+    Export_Job *jobs = NEW_ARR(Export_Job, count);
+    for (size_t i = 0; i < count; i++) {
+        const Audio_Export *export = &exports[i];
+        if (export->send >= NUM_SENDS) {
+            FAIL_FMT("no send %d", export->send);
+        }
+
+        Slice slice;
+        slice_defaults(&slice, export->start, export->end, false);
+        export_job_init(&jobs[i], &slice, params, export->send < 0 ? -1 : MAX_SLICES + export->send);
+        snprintf(jobs[i].path, sizeof(jobs[i].path), "%s", export->path);
+    }
+
+    size_t written = export_run(jobs, count);
+    FREE(jobs);
+    return written;
+}
+
+size_t audio_export_slices(const char *dir) {
+    SDL_LockMutex(audio_sys.slice_lock);
+    size_t count = 0;
+    for (Slice_Id id = 0; id < MAX_SLICES; id++) {
+        count += audio_sys.begun[id];
+    }
+
+    Export_Job *jobs = NEW_ARR(Export_Job, count);
+    size_t i = 0;
+    for (Slice_Id id = 0; id < MAX_SLICES; id++) {
+        if (!audio_sys.begun[id]) {
+            continue;
+        }
+
+        Channel *chan = &audio_sys.chans[id];
+        export_job_init(&jobs[i], pool_at(&audio_sys.slice_pool, id), chan->params, chan->output);
+        snprintf(jobs[i].path, sizeof(jobs[i].path), "%s/slice_%02d.wav", dir, id);
+        i++;
+    }
+    SDL_UnlockMutex(audio_sys.slice_lock);
+
+    size_t written = export_run(jobs, count);
+    FREE(jobs);
+    return written;
+}
+
+void audio_render(float *out, size_t frames) {
+    while (frames > 0) {
+        unsigned long block = frames < FRAMES_PER_BUFFER ? frames : FRAMES_PER_BUFFER;
+        audio_mix(out, block);
+        out += block * 2;
+        frames -= block;
+    }
 }
 
 float *audio_get_file_data(size_t *len) {
@@ -186,51 +844,218 @@ float *audio_get_file_data(size_t *len) {
     return audio_sys.file.data.f32;
 }
 
-static int audio_thread_callback(void *ud) {
-    IGNORE(ud);
+const Audio_File *audio_get_file() {
+    return &audio_sys.file;
+}
 
-    Pa_Initialize();
-    PaStreamParameters out_params = {
-        .device = Pa_GetDefaultOutputDevice(),
-        .channelCount = 2,
-        .sampleFormat = paFloat32,
-    };
+const Loudness_Index *audio_get_loudness() {
+    return audio_sys.loudness;
+}
 
-    out_params.suggestedLatency = 
-        Pa_GetDeviceInfo(out_params.device)->defaultLowOutputLatency;
-    Pa_OpenStream(&audio_sys.stream, NULL, &out_params, SAMPLE_RATE, 
-        FRAMES_PER_BUFFER, paClipOff, pa_callback, NULL);
+const Snap_Index *audio_get_snap() {
+    return audio_sys.snap;
+}
 
-    Pa_SetStreamFinishedCallback(audio_sys.stream, pa_finished_callback);
-    Pa_StartStream(audio_sys.stream);
+/* A device has no end of its own, so that is just watched for. */
+void audio_wait() {
+    if (audio_sys.backend->wait) {
+        audio_sys.backend->wait();
+        return;
+    }
 
-    audio_sys.ready = true;
+    while (!audio_sys.max_frames || audio_sys.frames < audio_sys.max_frames) {
+        SDL_Delay(1);
+    }
+}
+
+const Audio_Meters *audio_read_meters() {
+    return triple_read(audio_sys.meters);
+}
 
-    while (!audio_sys.stop) {
-        Pa_Sleep(100);
+double audio_get_time() {
+    return ((double) audio_sys.frames) / SAMPLE_RATE;
+}
+
+uint64_t audio_get_frames() {
+    return audio_sys.frames;
+}
+
+static void command_send(const Audio_Command *cmd) {
+    collect_trash();
+    while (!queue_push(audio_sys.commands, cmd)) {
+        SDL_Delay(1);
     }
+}
 
-    Pa_StopStream(audio_sys.stream);
-    Pa_CloseStream(audio_sys.stream);
-    Pa_Terminate();
+/* Runs on the audio thread at the top of every block, applying whatever
+ * falls inside it. Held commands go first, having been sent before anything
+ * still in the queue. Should too many be held, the rest apply early. */
+static void commands_receive(unsigned long frames) {
+    uint64_t end = audio_sys.frames + frames;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < audio_sys.npending; i++) {
+        Audio_Command *cmd = &audio_sys.pending[i];
+        if (cmd->type == COMMAND_NONE) {
+            continue;
+        } else if (cmd->frame < end) {
+            command_apply(cmd);
+        } else {
+            audio_sys.pending[kept++] = *cmd;
+        }
+    }
+    audio_sys.npending = kept;
+
+    Audio_Command cmd;
+    while (queue_pop(audio_sys.commands, &cmd)) {
+        if (command_stale(&cmd)) {
+            continue;
+        } else if (cmd.frame >= end && audio_sys.npending < MAX_PENDING) {
+            audio_sys.pending[audio_sys.npending++] = cmd;
+        } else {
+            command_apply(&cmd);
+        }
+    }
+}
 
-    audio_sys.has_stopped = true;
+static void command_apply(const Audio_Command *cmd) {
+    unsigned long offset = 0;
+    if (cmd->frame > audio_sys.frames) {
+        offset = (unsigned long) (cmd->frame - audio_sys.frames);
+    }
 
-    return 1;
+    Slice *slice = cmd->slice;
+    switch (cmd->type) {
+        case COMMAND_NONE:
+            break;
+        case COMMAND_PARAM_SET:
+            param_set(cmd->param, cmd->value);
+            break;
+        case COMMAND_PARAM_AUTOMATE: {
+            Audio_Trash trash = {param_automate(cmd->param, cmd->lane), NULL};
+            if (trash.lane) {
+                queue_push(audio_sys.trash, &trash);
+            }
+            break;
+        }
+        case COMMAND_SLICE_BEGIN: {
+            Slice_Id id = pool_index(&audio_sys.slice_pool, slice);
+            slice->next = audio_sys.cur_slice;
+            audio_sys.cur_slice = slice;
+            audio_sys.mixed[id] = true;
+            audio_sys.chans[id].output = cmd->output;
+            break;
+        }
+        case COMMAND_SLICE_END: {
+            /* Should the trash be full the slot is lost rather than put
+             * back here. */
+            slice_unlink(slice);
+            Audio_Trash trash = {NULL, slice};
+            queue_push(audio_sys.trash, &trash);
+            break;
+        }
+        case COMMAND_SLICE_SEND:
+            audio_sys.chans[pool_index(&audio_sys.slice_pool, slice)].output = cmd->output;
+            break;
+        case COMMAND_SLICE_PLAY:
+            /* A slice already sounding restarts from the top of the block
+             * rather than drop out until its frame. */
+            if (!slice->playing) {
+                slice_restart(slice, slice->stretch);
+            }
+            slice->play_at = slice->playing ? 0 : offset;
+            slice->stop_at = NO_STOP;
+            slice->playing = true;
+            slice->adsr = ADSR_RISING;
+            slice->adsr_index = 0;
+            break;
+        case COMMAND_SLICE_STOP:
+            slice->stop_at = offset;
+            break;
+        case COMMAND_SLICE_SET_INDEX:
+            slice->index = slice->start + cmd->index;
+            slice_restart(slice, slice->stretch);
+            break;
+        case COMMAND_SLICE_STRETCH:
+            slice->speed = cmd->value;
+            if (cmd->stretch != slice->stretch) {
+                slice_restart(slice, cmd->stretch);
+            }
+            break;
+        case COMMAND_SLICE_GAIN:
+            slice->gain = cmd->value;
+            break;
+    }
 }
 
-static int pa_callback(const void *in_buf, void *out_buf, 
-    unsigned long frames_per_buffer, const PaStreamCallbackTimeInfo *time_info, 
-    PaStreamCallbackFlags status_flags, void *ud) {
+/* Whether a command is for a slice that has ended, or was never begun. */
+static bool command_stale(const Audio_Command *cmd) {
+    return cmd->slice && cmd->type != COMMAND_SLICE_BEGIN
+        && !audio_sys.mixed[pool_index(&audio_sys.slice_pool, cmd->slice)];
+}
 
-    IGNORE(ud);
-    IGNORE(in_buf);
-    IGNORE(time_info);
-    IGNORE(status_flags);
+/* Takes an ended slice out of the mix, along with whatever was held for
+ * it, so nothing lands on whichever slice gets its slot next. */
+static void slice_unlink(Slice *slice) {
+    Slice **link = &audio_sys.cur_slice;
+    while (*link && *link != slice) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = slice->next;
+    }
+
+    for (size_t i = 0; i < audio_sys.npending; i++) {
+        if (audio_sys.pending[i].slice == slice) {
+            audio_sys.pending[i].type = COMMAND_NONE;
+        }
+    }
+
+    audio_sys.mixed[pool_index(&audio_sys.slice_pool, slice)] = false;
+    slice->playing = false;
+}
+
+static void collect_trash() {
+    Audio_Trash trash;
+    while (queue_pop(audio_sys.trash, &trash)) {
+        if (trash.lane) {
+            param_lane_free(trash.lane);
+        }
 
-    float *out = (float *) out_buf;
+        if (trash.slice) {
+            SDL_LockMutex(audio_sys.slice_lock);
+            pool_put(&audio_sys.slice_pool, trash.slice);
+            audio_sys.nending--;
+            SDL_UnlockMutex(audio_sys.slice_lock);
+        }
+    }
+}
 
-    for (unsigned long i = 0; i < frames_per_buffer; i++) {
+/* param_block() for the block being mixed. A lane that runs out goes to the
+ * trash; should that ever be full it leaks rather than free here. */
+static const float *block_param(Param *param, float *buf) {
+    Audio_Trash trash = {NULL, NULL};
+    const float *values = param_block(param, audio_sys.block_time, audio_sys.block_frames, buf, &trash.lane);
+    if (trash.lane) {
+        queue_push(audio_sys.trash, &trash);
+    }
+    return values;
+}
+
+static void audio_mix(float *out, unsigned long frames) {
+#ifdef AUDIO_SSE
+    /* Flush denormals. Decaying delay lines and reverb tails otherwise sink
+     * into them and every operation on them gets many times slower. Set
+     * each block since the backend owns the thread. */
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+
+    bool timed = SDL_AtomicGet(&audio_sys.timing_state) == TIMING_RUNNING;
+    Uint64 start = timed ? SDL_GetPerformanceCounter() : 0;
+
+    commands_receive(frames);
+
+    for (unsigned long i = 0; i < frames; i++) {
         out[i * 2] = 0.0f;
         out[i * 2 + 1] = 0.0f;
     }
@@ -242,118 +1067,550 @@ static int pa_callback(const void *in_buf, void *out_buf,
         }
     }
 
-    Slice *iter = audio_sys.cur_slice;
-    while (iter) {
+    size_t nactive = 0;
+    for (Slice *iter = audio_sys.cur_slice; iter; iter = iter->next) {
         if (iter->playing) {
-            Channel *chan = &audio_sys.chans[iter - audio_sys.slices];
-            for (unsigned long i = 0; i < frames_per_buffer; i++) {
-                if (iter->index > iter->end) {
-                    if (iter->loop) {
-                        iter->index = iter->start;
-                    } else {
-                        iter->playing = false;
-                        goto done;
-                    }
-                }
-
-                float adsr_scale = get_adsr_scale(iter);
-
-                chan->data[i * 2] += audio_sys.file.data.f32[iter->index * 2] * adsr_scale;
-                chan->data[i * 2 + 1] += audio_sys.file.data.f32[iter->index * 2 + 1] * adsr_scale;
-                iter->index++;
-            }
+            audio_sys.active[nactive++] = iter;
         }
-done:
+    }
 
-        iter = iter->next;
+    /* Every slice renders into its own channel, so the order slices finish
+     * in doesn't matter: the summing below always runs in channel order and
+     * the output is the same bits however the work got split. */
+    audio_sys.block_frames = frames;
+    audio_sys.block_time = audio_sys.frames;
+    if (audio_sys.pool && nactive >= PARALLEL_MIN_SLICES) {
+        workers_run(audio_sys.pool, nactive, slice_render_task, NULL);
+    } else {
+        for (size_t i = 0; i < nactive; i++) {
+            slice_render_task(NULL, i);
+        }
     }
 
+    /* Sends come after every slice channel, so whatever is routed to one has
+     * been summed into it by the time it is processed. */
+    Audio_Meters *meters = triple_back(audio_sys.meters);
     for (int i = 0; i < NUM_CHANNELS; i++) {
         Channel *chan = &audio_sys.chans[i];
+        if (i >= MAX_SLICES) {
+            send_process(chan, frames);
+        }
+
+        float *dst;
         if (chan->output == -1) {
-            for (unsigned long j = 0; j < frames_per_buffer; j++) {
-                float left, right;
-                channel_get_samples(chan, &left, &right);
-                out[j * 2] += left;
-                out[j * 2 + 1] += right;
-            }
+            channel_delay(chan, frames);
+            dst = out;
         } else {
-            Channel *dst = &audio_sys.chans[chan->output];
-            for (unsigned long j = 0; j < frames_per_buffer; j++) {
-                dst->data[j * 2] += chan->data[j * 2];
-                dst->data[j * 2 + 1] += chan->data[j * 2 + 1];
-            }
+            dst = audio_sys.chans[chan->output].data;
+        }
+
+        channel_volume(chan, frames);
+
+        meter_process(&chan->meter, chan->data, frames, &meters->chans[i]);
+
+        for (unsigned long j = 0; j < frames * 2; j++) {
+            dst[j] += chan->data[j];
         }
+    }
+
+    meter_process(&audio_sys.master_meter, out, frames, &meters->master);
+    triple_publish(audio_sys.meters);
+
+    audio_sys.frames += frames;
 
-        chan->data_idx = 0;
+    if (timed) {
+        timing_record(start);
+    }
+    SDL_AtomicCAS(&audio_sys.timing_state, TIMING_STOPPING, TIMING_IDLE);
+}
+
+static void timing_record(Uint64 start) {
+    Audio_Timing *timing = &audio_sys.timing;
+    double us = (SDL_GetPerformanceCounter() - start) / audio_sys.ticks_per_us;
+
+    size_t bucket = (size_t) (us / timing->bucket_us);
+    if (bucket >= AUDIO_TIMING_BUCKETS) {
+        bucket = AUDIO_TIMING_BUCKETS - 1;
     }
 
-    return paContinue;
+    timing->counts[bucket]++;
+    timing->blocks++;
+    if (us > timing->deadline_us) {
+        timing->late++;
+    }
+    if (us > timing->max_us) {
+        timing->max_us = us;
+    }
 }
 
-static void pa_finished_callback(void *ud) {
+static void slice_render_task(void *ud, size_t index) {
     IGNORE(ud);
+
+    Slice *slice = audio_sys.active[index];
+    Channel *chan = &audio_sys.chans[pool_index(&audio_sys.slice_pool, slice)];
+    slice_render(slice, chan, audio_sys.block_frames);
 }
 
-static void channel_get_samples(Channel *chan, float *l_out, float *r_out) {
-    float input_l = chan->data[chan->data_idx * 2];
-    float input_r = chan->data[chan->data_idx * 2 + 1];
+static void slice_render(Slice *slice, Channel *chan, unsigned long frames) {
+    float sustain_buf[FRAMES_PER_BUFFER];
+    const float *sustain = block_param(&slice->sustain, sustain_buf);
+    Stretch *stretch = &audio_sys.stretches[pool_index(&audio_sys.slice_pool, slice)];
+    voice_render(slice, stretch, sustain, chan->data, frames);
+}
 
-    float delay_l = chan->delay_data[chan->delay_idx * 2] * chan->delay_damp;
-    float delay_r = chan->delay_data[chan->delay_idx * 2 + 1] * chan->delay_damp;
+/* Mixes a slice into `out`, as recorded or stretched, wrapping if it loops.
+ * The block is cut into runs over which the source is contiguous and the
+ * envelope keeps one shape, and each run goes to its kernel; plays, stops,
+ * loop ends and envelope stages fall between runs. */
+static void voice_render(Slice *slice, Stretch *stretch, const float *sustain, float *out, unsigned long frames) {
+    const float *data = audio_sys.file.data.f32;
+    int nchannels = audio_sys.file.nchannels;
+
+    unsigned long stop_at = slice->stop_at;
+    unsigned long i = slice->play_at;
+    slice->stop_at = NO_STOP;
+    slice->play_at = 0;
+
+    bool stretching = slice->stretch != STRETCH_OFF;
+    float stretched[SAMPLES_PER_BUFFER];
+    unsigned long avail = frames;
+    if (stretching) {
+        Stretch_Source src = {data, nchannels, slice->start, slice->end, slice->loop};
+        avail = i + stretch_render(stretch, &src, slice->speed, &stretched[i * 2], frames - i);
+        slice->index = stretch_position(stretch);
+    }
 
-    float total_l = input_l + delay_l;
-    float total_r = input_r + delay_r;
+    while (i < frames) {
+        if (i == stop_at) {
+            slice->adsr = ADSR_RELEASED;
+            slice->adsr_index = 0;
+        }
 
-    chan->delay_data[chan->delay_idx * 2] = total_l;
-    chan->delay_data[chan->delay_idx * 2 + 1] = total_r;
+        unsigned long run = frames - i;
+        if (stop_at > i && stop_at - i < run) {
+            run = stop_at - i;
+        }
 
-    if (chan->delay_idx > chan->delay_len) {
-        chan->delay_idx = 0;
-    } else {
-        chan->delay_idx++;
+        const float *src;
+        bool stereo;
+        if (stretching) {
+            if (i == avail) {
+                slice->playing = false;
+                return;
+            }
+            if (avail - i < run) {
+                run = avail - i;
+            }
+            src = &stretched[i * 2];
+            stereo = true;
+        } else {
+            if (slice->index > slice->end) {
+                if (!slice->loop) {
+                    slice->playing = false;
+                    return;
+                }
+                slice->index = slice->start;
+            }
+            if (slice->end - slice->index + 1 < run) {
+                run = slice->end - slice->index + 1;
+            }
+            src = &data[slice->index * nchannels];
+            stereo = nchannels > 1;
+        }
+
+        Env_Span env;
+        if (!envelope_span(slice, sustain ? &sustain[i] : NULL, &run, &env)) {
+            slice->playing = false;
+            return;
+        }
+        voice_kernels[env.shape][stereo](&out[i * 2], src, &env, (int) run);
+
+        if (!stretching) {
+            slice->index += run;
+        }
+        i += run;
     }
+}
 
-    chan->data_idx++;
+static void send_process(Channel *chan, unsigned long frames) {
+    void *next = SDL_AtomicGetPtr(&chan->conv_next);
+    if (next) {
+        SDL_AtomicSetPtr(&chan->conv_dead, chan->conv);
+        chan->conv = next == CONV_OFF ? NULL : next;
+        SDL_AtomicSetPtr(&chan->conv_next, NULL);
+    }
 
-    *l_out = total_l;
-    *r_out = total_r;
+    if (!chan->conv) {
+        return;
+    }
+
+    float *wet = audio_sys.wet;
+    conv_process(chan->conv, chan->data, wet, frames);
+
+    float mix = chan->conv_mix;
+    for (unsigned long i = 0; i < frames * 2; i++) {
+        chan->data[i] = chan->data[i] * (1.0f - mix) + wet[i] * mix;
+    }
+}
+
+static void channel_delay(Channel *chan, unsigned long frames) {
+    float time_buf[FRAMES_PER_BUFFER], feedback_buf[FRAMES_PER_BUFFER];
+    const float *time = block_param(&chan->params[AUDIO_PARAM_DELAY_TIME], time_buf);
+    const float *feedback = block_param(&chan->params[AUDIO_PARAM_DELAY_FEEDBACK], feedback_buf);
+
+    delay_process(chan->delay_data, &chan->delay_pos, chan->data, frames,
+        time, chan->params[AUDIO_PARAM_DELAY_TIME].value,
+        feedback, chan->params[AUDIO_PARAM_DELAY_FEEDBACK].value);
+}
+
+/* A feedback delay whose length may be fractional, read between the two
+ * nearest frames, so it can glide. `line` holds MAX_DELAY_FRAMES frames. Per
+ * frame values are used where given, the fixed ones otherwise. */
+static void delay_process(float *line, size_t *pos_io, float *data, unsigned long frames,
+    const float *time, float time_fixed, const float *feedback, float feedback_fixed) {
+    size_t pos = *pos_io;
+    for (unsigned long i = 0; i < frames; i++) {
+        float delay = time ? time[i] : time_fixed;
+        float gain = feedback ? feedback[i] : feedback_fixed;
+
+        size_t whole = (size_t) delay;
+        float frac = delay - whole;
+        size_t r0 = pos >= whole ? pos - whole : pos + MAX_DELAY_FRAMES - whole;
+        size_t r1 = r0 ? r0 - 1 : MAX_DELAY_FRAMES - 1;
+
+        float delay_l = (line[r0 * 2] + (line[r1 * 2] - line[r0 * 2]) * frac) * gain;
+        float delay_r = (line[r0 * 2 + 1] + (line[r1 * 2 + 1] - line[r0 * 2 + 1]) * frac) * gain;
+
+        float total_l = data[i * 2] + delay_l;
+        float total_r = data[i * 2 + 1] + delay_r;
+
+        line[pos * 2] = total_l;
+        line[pos * 2 + 1] = total_r;
+        pos = pos + 1 < MAX_DELAY_FRAMES ? pos + 1 : 0;
+
+        data[i * 2] = total_l;
+        data[i * 2 + 1] = total_r;
+    }
+    *pos_io = pos;
+}
+
+static void channel_volume(Channel *chan, unsigned long frames) {
+    float gain_buf[FRAMES_PER_BUFFER];
+    const float *gain = block_param(&chan->params[AUDIO_PARAM_VOLUME], gain_buf);
+    scale_frames(chan->data, gain, chan->params[AUDIO_PARAM_VOLUME].value, frames);
+}
+
+/* Multiplies stereo frames by a gain per frame, or by `constant` when
+ * `gain` is NULL. */
+static void scale_frames(float *data, const float *gain, float constant, unsigned long frames) {
+    if (!gain) {
+        if (constant != 1.0f) {
+            for (unsigned long i = 0; i < frames * 2; i++) {
+                data[i] *= constant;
+            }
+        }
+        return;
+    }
+
+    unsigned long i = 0;
+#ifdef AUDIO_SSE
+    for (; i + 4 <= frames; i += 4) {
+        __m128 g = _mm_loadu_ps(&gain[i]);
+        __m128 lo = _mm_loadu_ps(&data[i * 2]);
+        __m128 hi = _mm_loadu_ps(&data[i * 2 + 4]);
+        _mm_storeu_ps(&data[i * 2], _mm_mul_ps(lo, _mm_unpacklo_ps(g, g)));
+        _mm_storeu_ps(&data[i * 2 + 4], _mm_mul_ps(hi, _mm_unpackhi_ps(g, g)));
+    }
+#endif
+
+    for (; i < frames; i++) {
+        data[i * 2] *= gain[i];
+        data[i * 2 + 1] *= gain[i];
+    }
 }
 
-static float get_adsr_scale(Slice *slice) {
-    float scale;
-start:
+/* The envelope over the next `*frames` frames, cut short where it moves
+ * on a stage, with the slice's gain folded in; the envelope is moved past
+ * them. `sustain`, if any, starts at the first. False once the release is
+ * over. */
+static bool envelope_span(Slice *slice, const float *sustain, unsigned long *frames, Env_Span *env) {
+    size_t at = slice->adsr_index;
+    unsigned long n = *frames;
+    env->sustain = sustain;
+    env->gain = slice->gain;
+
+    if (slice->adsr == ADSR_RISING && at >= slice->a) {
+        slice->adsr = ADSR_DECAYING;
+    }
+    if (slice->adsr == ADSR_DECAYING && at >= slice->a + slice->d) {
+        slice->adsr = ADSR_SUSTAINED;
+    }
+
     switch (slice->adsr) {
-        case ADSR_RISING:
-            if (slice->adsr_index >= slice->a) {
-                slice->adsr = ADSR_DECAYING;
-                goto start;
-            } else {
-                scale = ((float) slice->adsr_index) / slice->a;
+        case ADSR_RISING: {
+            if (slice->a - at < n) {
+                n = slice->a - at;
             }
+            float step = 1.0f / slice->a;
+            env->shape = ENV_LINE;
+            env->from = at * step * env->gain;
+            env->step = step * env->gain;
+            slice->level = (at + n - 1) * step;
             break;
-        case ADSR_DECAYING:
-            if (slice->adsr_index >= (slice->a + slice->d)) {
-                slice->adsr = ADSR_SUSTAINED;
-                goto start;
+        }
+        case ADSR_DECAYING: {
+            if (slice->a + slice->d - at < n) {
+                n = slice->a + slice->d - at;
+            }
+            float step = 1.0f / slice->d;
+            float from = (at - slice->a) * step;
+            float last = from + step * (n - 1);
+            if (sustain) {
+                env->shape = ENV_DECAY;
+                env->from = from;
+                env->step = step;
+                slice->level = 1.0f - (1.0f - sustain[n - 1]) * last;
             } else {
-                size_t decay_index = slice->adsr_index - slice->a;
-                scale = 1.0 - (1.0 - slice->s) * ((float) decay_index) / slice->d;
+                float fall = 1.0f - slice->sustain.value;
+                env->shape = ENV_LINE;
+                env->from = (1.0f - fall * from) * env->gain;
+                env->step = -fall * step * env->gain;
+                slice->level = 1.0f - fall * last;
             }
             break;
+        }
         case ADSR_SUSTAINED:
-            /* Skip incrementing the ADSR index. */
-            return slice->s;
-        case ADSR_RELEASED:
-            if (slice->adsr_index >= slice->r) {
-                slice->playing = false;
-                return 0.0f;
+            /* Holds without counting. */
+            if (sustain) {
+                env->shape = ENV_SUSTAIN;
+                slice->level = sustain[n - 1];
             } else {
-                scale = ((float) slice->adsr_index) / slice->r;
+                env->shape = ENV_LINE;
+                env->from = slice->sustain.value * env->gain;
+                env->step = 0.0f;
+                slice->level = slice->sustain.value;
+            }
+            *frames = n;
+            return true;
+        case ADSR_RELEASED: {
+            /* Fall from wherever the envelope was when the slice stopped. */
+            if (at == 0) {
+                slice->release_from = slice->level;
+            }
+
+            if (at >= slice->r) {
+                slice->level = 0.0f;
+                return false;
+            }
+            if (slice->r - at < n) {
+                n = slice->r - at;
             }
+            float step = slice->release_from / slice->r;
+            float from = slice->release_from - at * step;
+            env->shape = ENV_LINE;
+            env->from = from * env->gain;
+            env->step = -step * env->gain;
+            slice->level = from - step * (n - 1);
             break;
+        }
+    }
+
+    slice->adsr_index = at + n;
+    *frames = n;
+    return true;
+}
+
+static void channel_params_init(Param *params) {
+    param_init(&params[AUDIO_PARAM_VOLUME], 1.0f, SMOOTH_FRAMES);
+    param_init(&params[AUDIO_PARAM_DELAY_TIME], SAMPLE_RATE / 2, DELAY_SMOOTH_FRAMES);
+    param_init(&params[AUDIO_PARAM_DELAY_FEEDBACK], 0.2f, SMOOTH_FRAMES);
+}
+
+static void slice_defaults(Slice *slice, size_t start, size_t end, bool loop) {
+    slice->playing = false;
+    slice->start = start;
+    slice->end = end;
+    slice->loop = loop;
+    slice->index = start;
+    slice->a = SLICE_FADE_FRAMES;
+    slice->d = 0;
+    param_init(&slice->sustain, 1.0f, SMOOTH_FRAMES);
+    slice->r = SLICE_FADE_FRAMES;
+    slice->level = 0.0f;
+    slice->play_at = 0;
+    slice->stop_at = NO_STOP;
+    slice->speed = 1.0f;
+    slice->stretch = STRETCH_OFF;
+    slice->gain = 1.0f;
+}
+
+/* Stretching picks up from the slice's index with nothing carried over.
+ * Slices take turns at the heavy part by their place in the pool. */
+static void slice_restart(Slice *slice, Stretch_Mode mode) {
+    slice->stretch = mode;
+    if (mode == STRETCH_OFF) {
+        return;
     }
 
-    slice->adsr_index++;
-    return scale;
-}
\ No newline at end of file
+    size_t id = pool_index(&audio_sys.slice_pool, slice);
+    stretch_reset(&audio_sys.stretches[id], mode, slice->index, id * FRAMES_PER_BUFFER);
+}
+
+/* Freezes the path from a slice's channel out, each param at the value it
+ * is headed for; automation is not followed. Reverbs are cloned, so the
+ * render shares no state with the mixer. */
+static void export_job_init(Export_Job *job, const Slice *slice, const Param *params, int output) {
+    job->slice = *slice;
+    job->slice.loop = false;
+    job->slice.index = slice->start;
+    job->slice.playing = true;
+    job->slice.play_at = 0;
+    job->slice.stop_at = NO_STOP;
+    job->slice.adsr = ADSR_RISING;
+    job->slice.adsr_index = 0;
+    param_init(&job->slice.sustain, slice->sustain.target, 0);
+    job->ok = false;
+
+    Conv *conv = NULL;
+    float conv_mix = 0.0f;
+    job->nstages = 0;
+    for (;;) {
+        Export_Stage *stage = &job->stages[job->nstages++];
+        stage->conv = conv;
+        stage->conv_mix = conv_mix;
+        stage->volume = params[AUDIO_PARAM_VOLUME].target;
+        stage->delay = output == -1;
+        stage->delay_time = params[AUDIO_PARAM_DELAY_TIME].target;
+        stage->delay_feedback = params[AUDIO_PARAM_DELAY_FEEDBACK].target;
+
+        if (output == -1) {
+            break;
+        }
+
+        Channel *send = &audio_sys.chans[output];
+        SDL_LockMutex(audio_sys.conv_lock);
+        conv = send->conv ? conv_clone(send->conv) : NULL;
+        conv_mix = send->conv_mix;
+        SDL_UnlockMutex(audio_sys.conv_lock);
+        params = send->params;
+        output = send->output;
+    }
+}
+
+static size_t export_run(Export_Job *jobs, size_t count) {
+    Worker_Pool *pool = workers_create(0, false);
+    workers_run(pool, count, export_task, jobs);
+    workers_free(pool);
+
+    size_t written = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (int s = 0; s < jobs[i].nstages; s++) {
+            if (jobs[i].stages[s].conv) {
+                conv_free(jobs[i].stages[s].conv);
+            }
+        }
+
+        if (jobs[i].ok) {
+            written++;
+        }
+    }
+
+    LOG_FMT("exported %d of %d slices", (int) written, (int) count);
+    return written;
+}
+
+static void export_task(void *ud, size_t index) {
+    Export_Job *job = &((Export_Job *) ud)[index];
+    job->ok = export_render(job);
+}
+
+/* The slice plays through once as it would live, then the effects ring out
+ * until quiet. */
+static bool export_render(Export_Job *job) {
+    Wav_Writer writer;
+    if (!wav_writer_open(&writer, job->path, 2, SAMPLE_RATE)) {
+        LOG_ERROR_FMT("cannot open '%s' for writing", job->path);
+        return false;
+    }
+
+    Export_Stage *out_stage = &job->stages[job->nstages - 1];
+    float *line = NEW_ARR(float, MAX_DELAY_FRAMES * 2);
+    size_t line_pos = 0;
+
+    float *chunk = NEW_ARR(float, EXPORT_CHUNK_FRAMES * 2);
+    size_t chunk_frames = 0;
+
+    size_t silent_limit = EXPORT_SILENT_FRAMES;
+    if (out_stage->delay && out_stage->delay_feedback > 0.0f) {
+        silent_limit += (size_t) out_stage->delay_time;
+    }
+
+    /* Only jobs being rendered hold a stretcher, so a long list of them
+     * stays small. */
+    Slice *slice = &job->slice;
+    Stretch *stretch = NULL;
+    if (slice->stretch != STRETCH_OFF) {
+        stretch = NEW(Stretch);
+        stretch_reset(stretch, slice->stretch, slice->start, 0);
+    }
+
+    size_t tail = 0, silent = 0;
+    float wet[SAMPLES_PER_BUFFER];
+
+    while (tail < EXPORT_MAX_TAIL_SECONDS * SAMPLE_RATE && silent < silent_limit) {
+        float *data = &chunk[chunk_frames * 2];
+        memset(data, 0, SAMPLES_PER_BUFFER * sizeof(float));
+
+        if (slice->playing) {
+            voice_render(slice, stretch, NULL, data, FRAMES_PER_BUFFER);
+        }
+
+        for (int s = 0; s < job->nstages; s++) {
+            Export_Stage *stage = &job->stages[s];
+            if (stage->conv) {
+                conv_process(stage->conv, data, wet, FRAMES_PER_BUFFER);
+                for (int i = 0; i < SAMPLES_PER_BUFFER; i++) {
+                    data[i] = data[i] * (1.0f - stage->conv_mix) + wet[i] * stage->conv_mix;
+                }
+            }
+
+            if (stage->delay) {
+                delay_process(line, &line_pos, data, FRAMES_PER_BUFFER,
+                    NULL, stage->delay_time, NULL, stage->delay_feedback);
+            }
+
+            scale_frames(data, NULL, stage->volume, FRAMES_PER_BUFFER);
+        }
+
+        if (!slice->playing) {
+            bool quiet = true;
+            for (int i = 0; i < SAMPLES_PER_BUFFER && quiet; i++) {
+                quiet = data[i] < EXPORT_SILENCE && data[i] > -EXPORT_SILENCE;
+            }
+
+            silent = quiet ? silent + FRAMES_PER_BUFFER : 0;
+            tail += FRAMES_PER_BUFFER;
+        }
+
+        chunk_frames += FRAMES_PER_BUFFER;
+        if (chunk_frames == EXPORT_CHUNK_FRAMES) {
+            if (!wav_writer_write(&writer, chunk, chunk_frames)) {
+                break;
+            }
+            chunk_frames = 0;
+        }
+    }
+
+    wav_writer_write(&writer, chunk, chunk_frames);
+    bool ok = wav_writer_close(&writer);
+    if (!ok) {
+        LOG_ERROR_FMT("failed writing '%s'", job->path);
+    }
+
+    if (stretch) {
+        FREE(stretch);
+    }
+    FREE(chunk);
+    FREE(line);
+    return ok;
+}
@@ -0,0 +1,19 @@
+#include <string.h>
+
+#include <aleph/audio_backend.h>
+
+static const Audio_Backend *backends[] = {
+    &audio_backend_portaudio,
+    &audio_backend_null,
+    &audio_backend_file,
+};
+
+const Audio_Backend *audio_backend_find(const char *name) {
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcmp(backends[i]->name, name) == 0) {
+            return backends[i];
+        }
+    }
+
+    return NULL;
+}
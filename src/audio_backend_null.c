@@ -0,0 +1,124 @@
+#include <SDL.h>
+
+#include <aleph/alloc.h>
+#include <aleph/audio_backend.h>
+#include <aleph/audio_file.h>
+
+/* Drives the mixer from a simulated clock instead of a device: one block
+ * every frames_per_buffer / sample_rate seconds when realtime, back to back
+ * otherwise. The file backend is the same loop writing each block out. With
+ * a frame limit the last block is cut short to land on it exactly. */
+static struct {
+    SDL_Thread *thread;
+    SDL_atomic_t stop;
+    Audio_Backend_Config config;
+    Audio_Render_Fn render;
+    float *buf;
+    Wav_Writer writer;
+    bool writing;
+} null_sys;
+
+static bool null_start(const Audio_Backend_Config *config, Audio_Render_Fn render);
+static bool file_start(const Audio_Backend_Config *config, Audio_Render_Fn render);
+static void null_stop();
+static void null_wait();
+static int null_thread(void *ud);
+
+const Audio_Backend audio_backend_null = {
+    .name = "null",
+    .start = null_start,
+    .stop = null_stop,
+    .wait = null_wait,
+};
+
+const Audio_Backend audio_backend_file = {
+    .name = "file",
+    .start = file_start,
+    .stop = null_stop,
+    .wait = null_wait,
+};
+
+static bool null_start(const Audio_Backend_Config *config, Audio_Render_Fn render) {
+    null_sys.config = *config;
+    null_sys.render = render;
+    null_sys.buf = NEW_ARR(float, config->frames_per_buffer * 2);
+    SDL_AtomicSet(&null_sys.stop, 0);
+    null_sys.thread = SDL_CreateThread(null_thread, "audio", NULL);
+
+    return true;
+}
+
+static bool file_start(const Audio_Backend_Config *config, Audio_Render_Fn render) {
+    const char *path = config->path ? config->path : "out.wav";
+    if (!wav_writer_open(&null_sys.writer, path, 2, config->sample_rate)) {
+        LOG_ERROR_FMT("cannot open '%s' for writing", path);
+        return false;
+    }
+
+    null_sys.writing = true;
+    return null_start(config, render);
+}
+
+static void null_stop() {
+    SDL_AtomicSet(&null_sys.stop, 1);
+    null_wait();
+
+    if (null_sys.writing) {
+        if (!wav_writer_close(&null_sys.writer)) {
+            LOG_ERROR("file backend: failed writing the output");
+        }
+        null_sys.writing = false;
+    }
+
+    FREE(null_sys.buf);
+    null_sys.buf = NULL;
+}
+
+static void null_wait() {
+    if (null_sys.thread) {
+        SDL_WaitThread(null_sys.thread, NULL);
+        null_sys.thread = NULL;
+    }
+}
+
+static int null_thread(void *ud) {
+    IGNORE(ud);
+
+    alloc_set_realtime(true);
+    if (null_sys.config.realtime) {
+        SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
+    }
+
+    uint64_t limit = null_sys.config.max_frames;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    uint64_t rendered = 0;
+
+    while (!SDL_AtomicGet(&null_sys.stop) && (!limit || rendered < limit)) {
+        unsigned long frames = null_sys.config.frames_per_buffer;
+        if (limit && limit - rendered < frames) {
+            frames = (unsigned long) (limit - rendered);
+        }
+
+        null_sys.render(null_sys.buf, frames);
+        rendered += frames;
+
+        /* A failed write is reported on close. */
+        if (null_sys.writing) {
+            wav_writer_write(&null_sys.writer, null_sys.buf, frames);
+        }
+
+        if (null_sys.config.realtime) {
+            Uint64 due = start + (Uint64) (((double) rendered) * freq / null_sys.config.sample_rate);
+            Uint64 now = SDL_GetPerformanceCounter();
+            if (due > now) {
+                Uint32 ms = (Uint32) ((due - now) * 1000 / freq);
+                if (ms > 0) {
+                    SDL_Delay(ms);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
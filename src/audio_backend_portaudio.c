@@ -0,0 +1,84 @@
+#include <portaudio.h>
+
+#include <aleph/alloc.h>
+#include <aleph/audio_backend.h>
+
+static struct {
+    PaStream *stream;
+    Audio_Render_Fn render;
+} pa_sys;
+
+static bool pa_start(const Audio_Backend_Config *config, Audio_Render_Fn render);
+static void pa_stop();
+static int pa_callback(const void *in_buf, void *out_buf, 
+    unsigned long frames_per_buffer, const PaStreamCallbackTimeInfo *time_info, 
+    PaStreamCallbackFlags status_flags, void *ud);
+static void pa_finished_callback(void *ud);
+
+const Audio_Backend audio_backend_portaudio = {
+    .name = "portaudio",
+    .start = pa_start,
+    .stop = pa_stop,
+};
+
+static bool pa_start(const Audio_Backend_Config *config, Audio_Render_Fn render) {
+    pa_sys.render = render;
+
+    PaError err = Pa_Initialize();
+    if (err != paNoError) {
+        LOG_ERROR_FMT("portaudio: %s", Pa_GetErrorText(err));
+        return false;
+    }
+
+    PaStreamParameters out_params = {
+        .device = Pa_GetDefaultOutputDevice(),
+        .channelCount = 2,
+        .sampleFormat = paFloat32,
+    };
+
+    if (out_params.device == paNoDevice) {
+        LOG_ERROR("portaudio: no default output device");
+        Pa_Terminate();
+        return false;
+    }
+
+    out_params.suggestedLatency = 
+        Pa_GetDeviceInfo(out_params.device)->defaultLowOutputLatency;
+    err = Pa_OpenStream(&pa_sys.stream, NULL, &out_params, config->sample_rate, 
+        config->frames_per_buffer, paClipOff, pa_callback, NULL);
+    if (err != paNoError) {
+        LOG_ERROR_FMT("portaudio: %s", Pa_GetErrorText(err));
+        Pa_Terminate();
+        return false;
+    }
+
+    Pa_SetStreamFinishedCallback(pa_sys.stream, pa_finished_callback);
+    Pa_StartStream(pa_sys.stream);
+
+    return true;
+}
+
+static void pa_stop() {
+    Pa_StopStream(pa_sys.stream);
+    Pa_CloseStream(pa_sys.stream);
+    Pa_Terminate();
+}
+
+static int pa_callback(const void *in_buf, void *out_buf, 
+    unsigned long frames_per_buffer, const PaStreamCallbackTimeInfo *time_info, 
+    PaStreamCallbackFlags status_flags, void *ud) {
+
+    IGNORE(ud);
+    IGNORE(in_buf);
+    IGNORE(time_info);
+    IGNORE(status_flags);
+
+    alloc_set_realtime(true);
+    pa_sys.render((float *) out_buf, frames_per_buffer);
+
+    return paContinue;
+}
+
+static void pa_finished_callback(void *ud) {
+    IGNORE(ud);
+}
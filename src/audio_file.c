@@ -1,7 +1,11 @@
+#include <aleph/alloc.h>
 #include <aleph/membuf.h>
 #include <aleph/audio_file.h>
+#include <aleph/flac.h>
+#include <aleph/workers.h>
 
 #include <stdio.h>
+#include <string.h>
 
 typedef struct {
     uint8_t riff[4];
@@ -19,20 +23,64 @@ typedef struct {
     uint32_t data_size;
 } Wav_Header;
 
+#define LOAD_ARENA_BLOCK (1 << 20)
+
+#define WRITE_CHUNK_SAMPLES 1024
+
+static bool decode_wav(Audio_File *file, Membuf *buf);
+
+/* The raw file only lives as long as its decode, in an arena of the call's
+ * own, so loads on different threads share nothing and none of it stays. */
+bool audio_file_load(Audio_File *file, const char *path) {
+    Arena arena;
+    arena_init(&arena, LOAD_ARENA_BLOCK);
+
+    Membuf buf;
+    if (!membuf_load_arena(&buf, &arena, path)) {
+        arena_free(&arena);
+        return false;
+    }
+
+    bool ok;
+    if (buf.len >= 4 && memcmp(buf.data, "fLaC", 4) == 0) {
+        Worker_Pool *pool = workers_create(0, false);
+        ok = flac_decode(file, buf.data, buf.len, pool);
+        workers_free(pool);
+    } else {
+        ok = decode_wav(file, &buf);
+    }
+
+    arena_free(&arena);
+
+    return ok;
+}
+
 bool audio_file_load_wav(Audio_File *file, const char *path) {
+    Arena arena;
+    arena_init(&arena, LOAD_ARENA_BLOCK);
+
     Membuf buf;
-    if (!membuf_load(&buf, path)) {
+    if (!membuf_load_arena(&buf, &arena, path)) {
+        arena_free(&arena);
         return false;
     }
 
-    Wav_Header *hdr = (Wav_Header *) buf.data;
+    bool ok = decode_wav(file, &buf);
+    arena_free(&arena);
+
+    return ok;
+}
+
+static bool decode_wav(Audio_File *file, Membuf *buf) {
+    Wav_Header *hdr = (Wav_Header *) buf->data;
 
     file->nchannels = hdr->chan_ct;
+    file->sample_rate = hdr->sample_rate;
     file->sample_t = SAMPLE_TYPE_F32;
     file->len = hdr->data_size / (hdr->bits_per_sample / 8);
     float *output_data = NEW_ARR(float, file->len);
     if (hdr->bits_per_sample == 16) {
-        int16_t *data = (uint16_t *) (buf.data + sizeof(Wav_Header));
+        int16_t *data = (uint16_t *) (buf->data + sizeof(Wav_Header));
         for (size_t i = 0; i < file->len; i++) {
             float f = ((float) data[i]) / ((float) 32768);
             if (f > 1) f = 1.0;
@@ -46,11 +94,79 @@ bool audio_file_load_wav(Audio_File *file, const char *path) {
 
     file->data.f32 = output_data;
 
-    membuf_free(&buf);
+    return true;
+}
 
+bool wav_writer_open(Wav_Writer *writer, const char *path, int nchannels, int sample_rate) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+
+    Wav_Header hdr = {
+        .riff = {'R', 'I', 'F', 'F'},
+        .wave = {'W', 'A', 'V', 'E'},
+        .fmt = {'f', 'm', 't', ' '},
+        .fmtlen = 16,
+        .format = 1,
+        .chan_ct = nchannels,
+        .sample_rate = sample_rate,
+        .byte_rate = sample_rate * nchannels * 2,
+        .block_align = nchannels * 2,
+        .bits_per_sample = 16,
+        .data = {'d', 'a', 't', 'a'},
+    };
+    writer->handle = f;
+    writer->nchannels = nchannels;
+    writer->frames = 0;
+    writer->ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+    return true;
+}
+
+bool wav_writer_write(Wav_Writer *writer, const float *data, size_t frames) {
+    if (!writer->ok) {
+        return false;
+    }
+
+    int16_t chunk[WRITE_CHUNK_SAMPLES];
+    size_t len = frames * writer->nchannels;
+
+    for (size_t done = 0; done < len; done += WRITE_CHUNK_SAMPLES) {
+        size_t n = len - done < WRITE_CHUNK_SAMPLES ? len - done : WRITE_CHUNK_SAMPLES;
+        for (size_t i = 0; i < n; i++) {
+            float f = data[done + i];
+            if (f > 1) f = 1.0;
+            if (f < -1) f = -1.0;
+            chunk[i] = (int16_t) (f * 32767.0f);
+        }
+        if (fwrite(chunk, sizeof(int16_t), n, (FILE *) writer->handle) != n) {
+            writer->ok = false;
+            return false;
+        }
+    }
+
+    writer->frames += frames;
     return true;
 }
 
+bool wav_writer_close(Wav_Writer *writer) {
+    FILE *f = (FILE *) writer->handle;
+
+    uint32_t data_size = writer->frames * writer->nchannels * 2;
+    uint32_t riff_size = data_size + sizeof(Wav_Header) - 8;
+    bool ok = writer->ok
+        && fseek(f, offsetof(Wav_Header, size), SEEK_SET) == 0
+        && fwrite(&riff_size, sizeof(riff_size), 1, f) == 1
+        && fseek(f, offsetof(Wav_Header, data_size), SEEK_SET) == 0
+        && fwrite(&data_size, sizeof(data_size), 1, f) == 1;
+
+    /* Buffered writes can still fail here. */
+    ok = fclose(f) == 0 && ok;
+    writer->handle = NULL;
+    return ok;
+}
+
 void audio_file_free(Audio_File *file) {
     if (file->sample_t == SAMPLE_TYPE_F32) {
         FREE(file->data.f32);
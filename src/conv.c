@@ -0,0 +1,382 @@
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CONV_SSE
+#endif
+
+#include <aleph/audio_file.h>
+#include <aleph/conv.h>
+#include <aleph/fft.h>
+
+/* The tail starts where the head stops, two tail blocks in. That leaves one
+ * tail block of slack between a tail block of input completing and its
+ * first output being due. */
+#define TAIL_OFFSET (CONV_TAIL_BLOCK * 2)
+#define TAIL_STEPS (CONV_TAIL_BLOCK / CONV_BLOCK)
+
+/* Spectra of real stereo signals are kept as bins 0..n/2 of each channel in
+ * split (re, im) arrays, padded to a multiple of 4 for SSE: one "slot" is
+ * `nbins` floats each of left re, left im, right re and right im. */
+typedef struct {
+    size_t block; /* Frames per partition. */
+    size_t nbins;
+    size_t npart;
+    Fft fft;
+
+    float *ir; /* npart slots of partition spectra. */
+    float *fdl; /* npart slots of input spectra, newest at fdl_pos. */
+    size_t fdl_pos;
+
+    float *acc; /* One slot. */
+    float *win; /* Last two blocks of input, interleaved stereo. */
+    float *buf; /* FFT scratch, block * 2 complex values. */
+} Conv_Stage;
+
+struct Conv {
+    Conv_Stage head, tail;
+    bool has_tail;
+
+    /* Frames into the current head and tail block. */
+    size_t head_fill, tail_fill;
+
+    float *cur; /* Spectrum of the partial head block. */
+    float *sum; /* Head output spectrum. */
+    float *tail_out; /* Tail output for the current tail block. */
+};
+
+static void stage_init(Conv_Stage *stage, size_t block, const float *ir,
+    size_t frames, int nchannels, float gain);
+static void stage_clone(Conv_Stage *stage, const Conv_Stage *src);
+static void stage_free(Conv_Stage *stage);
+static void stage_transform(Conv_Stage *stage, float *slot);
+static void stage_inverse(Conv_Stage *stage, const float *slot);
+static void stage_mac(Conv_Stage *stage, float *acc, size_t first, size_t last, size_t age);
+static float *stage_next_slot(Conv_Stage *stage);
+static void stage_shift(Conv_Stage *stage);
+static void spectrum_mac(float *acc, const float *x, const float *h, size_t nbins);
+static void conv_chunk(Conv *conv, const float *in, float *out, size_t frames);
+
+Conv *conv_create(const float *ir, size_t frames, int nchannels, float gain) {
+    Conv *conv = NEW(Conv);
+
+    size_t head_frames = frames < TAIL_OFFSET ? frames : TAIL_OFFSET;
+    stage_init(&conv->head, CONV_BLOCK, ir, head_frames, nchannels, gain);
+
+    conv->has_tail = frames > TAIL_OFFSET;
+    if (conv->has_tail) {
+        stage_init(&conv->tail, CONV_TAIL_BLOCK, ir + TAIL_OFFSET * nchannels,
+            frames - TAIL_OFFSET, nchannels, gain);
+        conv->tail_out = NEW_ARR(float, CONV_TAIL_BLOCK * 2);
+    }
+
+    conv->cur = NEW_ARR(float, conv->head.nbins * 4);
+    conv->sum = NEW_ARR(float, conv->head.nbins * 4);
+
+    return conv;
+}
+
+Conv *conv_clone(const Conv *src) {
+    Conv *conv = NEW(Conv);
+
+    stage_clone(&conv->head, &src->head);
+
+    conv->has_tail = src->has_tail;
+    if (conv->has_tail) {
+        stage_clone(&conv->tail, &src->tail);
+        conv->tail_out = NEW_ARR(float, CONV_TAIL_BLOCK * 2);
+    }
+
+    conv->cur = NEW_ARR(float, conv->head.nbins * 4);
+    conv->sum = NEW_ARR(float, conv->head.nbins * 4);
+
+    return conv;
+}
+
+Conv *conv_load(const char *path, int sample_rate, float gain) {
+    Audio_File file;
+    if (!audio_file_load(&file, path)) {
+        return NULL;
+    }
+
+    if (file.nchannels < 1 || file.nchannels > 2) {
+        LOG_ERROR_FMT("impulse response '%s' has %d channels", path, file.nchannels);
+        audio_file_free(&file);
+        return NULL;
+    }
+
+    if (file.sample_rate != sample_rate) {
+        LOG_WARN_FMT("impulse response '%s' is %dHz, playing at %dHz",
+            path, file.sample_rate, sample_rate);
+    }
+
+    size_t frames = file.len / file.nchannels;
+    Conv *conv = conv_create(file.data.f32, frames, file.nchannels, gain);
+    LOG_FMT("loaded impulse response '%s' (%d frames)", path, (int) frames);
+
+    audio_file_free(&file);
+    return conv;
+}
+
+void conv_free(Conv *conv) {
+    stage_free(&conv->head);
+    if (conv->has_tail) {
+        stage_free(&conv->tail);
+        FREE(conv->tail_out);
+    }
+
+    FREE(conv->cur);
+    FREE(conv->sum);
+    FREE(conv);
+}
+
+void conv_process(Conv *conv, const float *in, float *out, size_t frames) {
+    /* Split so no chunk crosses a head block, which also keeps the tail's
+     * steps on head block boundaries. */
+    while (frames > 0) {
+        size_t left = CONV_BLOCK - conv->head_fill;
+        size_t n = frames < left ? frames : left;
+
+        conv_chunk(conv, in, out, n);
+
+        in += n * 2;
+        out += n * 2;
+        frames -= n;
+    }
+}
+
+static void conv_chunk(Conv *conv, const float *in, float *out, size_t frames) {
+    Conv_Stage *head = &conv->head;
+    Conv_Stage *tail = &conv->tail;
+    size_t fill = conv->head_fill;
+    size_t nbins = head->nbins;
+
+    /* Take the input before writing anything, `in` may be `out`. */
+    memcpy(&head->win[(CONV_BLOCK + fill) * 2], in, frames * 2 * sizeof(float));
+    if (conv->has_tail) {
+        memcpy(&tail->win[(CONV_TAIL_BLOCK + conv->tail_fill) * 2], in,
+            frames * 2 * sizeof(float));
+    }
+
+    /* Partitions past the first only see whole blocks, so their sum is
+     * built once when a block starts. Every chunk then transforms the
+     * partial block, zeros past the input, and adds it through the first
+     * partition, which makes these frames exact without waiting for the
+     * block to fill. */
+    if (fill == 0) {
+        memset(head->acc, 0, nbins * 4 * sizeof(float));
+        stage_mac(head, head->acc, 1, head->npart, 1);
+    }
+
+    stage_transform(head, conv->cur);
+    memcpy(conv->sum, head->acc, nbins * 4 * sizeof(float));
+    spectrum_mac(conv->sum, conv->cur, head->ir, nbins);
+    stage_inverse(head, conv->sum);
+
+    memcpy(out, &head->buf[(CONV_BLOCK + fill) * 2], frames * 2 * sizeof(float));
+
+    conv->head_fill += frames;
+    if (conv->head_fill == CONV_BLOCK) {
+        memcpy(stage_next_slot(head), conv->cur, nbins * 4 * sizeof(float));
+        stage_shift(head);
+        conv->head_fill = 0;
+    }
+
+    if (!conv->has_tail) {
+        return;
+    }
+
+    const float *tail_out = &conv->tail_out[conv->tail_fill * 2];
+    for (size_t i = 0; i < frames * 2; i++) {
+        out[i] += tail_out[i];
+    }
+
+    conv->tail_fill += frames;
+    if (conv->tail_fill % CONV_BLOCK != 0) {
+        return;
+    }
+
+    /* The output for the next tail block is due as soon as this one
+     * completes. All head blocks but the last sum a share of the
+     * partitions; the last transforms the sum back and takes in the tail
+     * block that just completed. */
+    size_t step = conv->tail_fill / CONV_BLOCK - 1;
+    if (step < TAIL_STEPS - 1) {
+        size_t first = tail->npart * step / (TAIL_STEPS - 1);
+        size_t last = tail->npart * (step + 1) / (TAIL_STEPS - 1);
+        stage_mac(tail, tail->acc, first, last, 0);
+    } else {
+        stage_inverse(tail, tail->acc);
+        memcpy(conv->tail_out, &tail->buf[CONV_TAIL_BLOCK * 2],
+            CONV_TAIL_BLOCK * 2 * sizeof(float));
+        memset(tail->acc, 0, tail->nbins * 4 * sizeof(float));
+
+        stage_transform(tail, stage_next_slot(tail));
+        stage_shift(tail);
+        conv->tail_fill = 0;
+    }
+}
+
+static void stage_init(Conv_Stage *stage, size_t block, const float *ir,
+    size_t frames, int nchannels, float gain) {
+    stage->block = block;
+    stage->nbins = (block + 1 + 3) & ~((size_t) 3);
+    stage->npart = (frames + block - 1) / block;
+    if (stage->npart == 0) {
+        stage->npart = 1;
+    }
+    stage->fdl_pos = 0;
+
+    fft_init(&stage->fft, block * 2);
+
+    size_t slot_len = stage->nbins * 4;
+    stage->ir = NEW_ARR(float, stage->npart * slot_len);
+    stage->fdl = NEW_ARR(float, stage->npart * slot_len);
+    stage->acc = NEW_ARR(float, slot_len);
+    stage->win = NEW_ARR(float, block * 4);
+    stage->buf = NEW_ARR(float, block * 4);
+
+    /* Each partition is zero padded to two blocks; left and right go in as
+     * the real and imaginary parts of one transform. */
+    for (size_t part = 0; part < stage->npart; part++) {
+        memset(stage->buf, 0, block * 4 * sizeof(float));
+        for (size_t i = 0; i < block && part * block + i < frames; i++) {
+            const float *frame = &ir[(part * block + i) * nchannels];
+            stage->buf[i * 2] = frame[0] * gain;
+            stage->buf[i * 2 + 1] = frame[nchannels - 1] * gain;
+        }
+
+        memcpy(stage->win, stage->buf, block * 4 * sizeof(float));
+        stage_transform(stage, &stage->ir[part * slot_len]);
+    }
+
+    /* Touch the delay line now, rather than page faulting on the audio
+     * thread the first time each slot is written. */
+    memset(stage->fdl, 0, stage->npart * slot_len * sizeof(float));
+    memset(stage->win, 0, block * 4 * sizeof(float));
+}
+
+/* Only reads the partition spectra, which nothing writes after init. */
+static void stage_clone(Conv_Stage *stage, const Conv_Stage *src) {
+    stage->block = src->block;
+    stage->nbins = src->nbins;
+    stage->npart = src->npart;
+    stage->fdl_pos = 0;
+
+    fft_init(&stage->fft, stage->block * 2);
+
+    size_t slot_len = stage->nbins * 4;
+    stage->ir = NEW_ARR(float, stage->npart * slot_len);
+    memcpy(stage->ir, src->ir, stage->npart * slot_len * sizeof(float));
+    stage->fdl = NEW_ARR(float, stage->npart * slot_len);
+    stage->acc = NEW_ARR(float, slot_len);
+    stage->win = NEW_ARR(float, stage->block * 4);
+    stage->buf = NEW_ARR(float, stage->block * 4);
+}
+
+static void stage_free(Conv_Stage *stage) {
+    fft_free(&stage->fft);
+    FREE(stage->ir);
+    FREE(stage->fdl);
+    FREE(stage->acc);
+    FREE(stage->win);
+    FREE(stage->buf);
+}
+
+/* Transforms the window into a slot. The window's frames are the real (left)
+ * and imaginary (right) parts of one complex signal; the two real spectra
+ * are pulled apart using their conjugate symmetry. */
+static void stage_transform(Conv_Stage *stage, float *slot) {
+    size_t n = stage->block * 2;
+    size_t nbins = stage->nbins;
+    float *buf = stage->buf;
+
+    memcpy(buf, stage->win, n * 2 * sizeof(float));
+    fft_forward(&stage->fft, buf);
+
+    float *l_re = slot, *l_im = slot + nbins;
+    float *r_re = slot + nbins * 2, *r_im = slot + nbins * 3;
+
+    for (size_t k = 0; k <= n / 2; k++) {
+        size_t m = (n - k) % n;
+        float a_re = buf[k * 2], a_im = buf[k * 2 + 1];
+        float c_re = buf[m * 2], c_im = buf[m * 2 + 1];
+
+        l_re[k] = (a_re + c_re) * 0.5f;
+        l_im[k] = (a_im - c_im) * 0.5f;
+        r_re[k] = (a_im + c_im) * 0.5f;
+        r_im[k] = (c_re - a_re) * 0.5f;
+    }
+}
+
+/* Packs a slot back into one complex spectrum and transforms it, leaving left
+ * and right as the real and imaginary parts of `buf`. */
+static void stage_inverse(Conv_Stage *stage, const float *slot) {
+    size_t n = stage->block * 2;
+    size_t nbins = stage->nbins;
+    float *buf = stage->buf;
+
+    const float *l_re = slot, *l_im = slot + nbins;
+    const float *r_re = slot + nbins * 2, *r_im = slot + nbins * 3;
+
+    for (size_t k = 0; k <= n / 2; k++) {
+        buf[k * 2] = l_re[k] - r_im[k];
+        buf[k * 2 + 1] = l_im[k] + r_re[k];
+    }
+
+    for (size_t k = n / 2 + 1; k < n; k++) {
+        size_t m = n - k;
+        buf[k * 2] = l_re[m] + r_im[m];
+        buf[k * 2 + 1] = r_re[m] - l_im[m];
+    }
+
+    fft_inverse(&stage->fft, buf);
+}
+
+/* Adds partitions [first, last) times their input spectra into `acc`.
+ * Partition `age` lines up with the newest input spectrum. */
+static void stage_mac(Conv_Stage *stage, float *acc, size_t first, size_t last, size_t age) {
+    size_t slot_len = stage->nbins * 4;
+    for (size_t part = first; part < last; part++) {
+        size_t pos = (stage->fdl_pos + stage->npart - (part - age)) % stage->npart;
+        spectrum_mac(acc, &stage->fdl[pos * slot_len], &stage->ir[part * slot_len], stage->nbins);
+    }
+}
+
+static float *stage_next_slot(Conv_Stage *stage) {
+    stage->fdl_pos = (stage->fdl_pos + 1) % stage->npart;
+    return &stage->fdl[stage->fdl_pos * stage->nbins * 4];
+}
+
+static void stage_shift(Conv_Stage *stage) {
+    size_t half = stage->block * 2;
+    memcpy(stage->win, &stage->win[half], half * sizeof(float));
+    memset(&stage->win[half], 0, half * sizeof(float));
+}
+
+/* acc += x * h, complex, for both channels of a slot. */
+static void spectrum_mac(float *acc, const float *x, const float *h, size_t nbins) {
+    for (int chan = 0; chan < 2; chan++) {
+        float *a_re = acc + nbins * chan * 2, *a_im = a_re + nbins;
+        const float *x_re = x + nbins * chan * 2, *x_im = x_re + nbins;
+        const float *h_re = h + nbins * chan * 2, *h_im = h_re + nbins;
+
+#ifdef CONV_SSE
+        for (size_t i = 0; i < nbins; i += 4) {
+            __m128 xr = _mm_loadu_ps(x_re + i), xi = _mm_loadu_ps(x_im + i);
+            __m128 hr = _mm_loadu_ps(h_re + i), hi = _mm_loadu_ps(h_im + i);
+
+            __m128 re = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+            __m128 im = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+
+            _mm_storeu_ps(a_re + i, _mm_add_ps(_mm_loadu_ps(a_re + i), re));
+            _mm_storeu_ps(a_im + i, _mm_add_ps(_mm_loadu_ps(a_im + i), im));
+        }
+#else
+        for (size_t i = 0; i < nbins; i++) {
+            a_re[i] += x_re[i] * h_re[i] - x_im[i] * h_im[i];
+            a_im[i] += x_re[i] * h_im[i] + x_im[i] * h_re[i];
+        }
+#endif
+    }
+}
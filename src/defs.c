@@ -3,27 +3,21 @@
 #include <stdlib.h>
 
 #include <aleph/defs.h>
+#include <aleph/log.h>
 
 void _fail(const char *fmt, const char *file, int line, ...) {
     va_list args;
     va_start(args, line);
 
+    /* Get everything logged before the failure out first. */
+    log_flush();
+
     printf("LOG: %s:%d: ", file, line);
     vprintf(fmt, args);
     printf("\n");
+    fflush(stdout);
 
     va_end(args);
 
     exit(EXIT_FAILURE);
 }
-
-void _log(const char *fmt, const char *file, int line, ...) {
-    va_list args;
-    va_start(args, line);
-
-    printf("LOG: %s:%d: ", file, line);
-    vprintf(fmt, args);
-    printf("\n");
-
-    va_end(args);
-}
\ No newline at end of file
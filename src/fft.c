@@ -0,0 +1,148 @@
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FFT_SSE
+#endif
+
+#include <aleph/fft.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static void fft_transform(Fft *fft, float *data, bool inverse);
+
+bool fft_init(Fft *fft, size_t n) {
+    int log2n = 0;
+    while (((size_t) 1 << log2n) < n) {
+        log2n++;
+    }
+
+    if (n < 2 || ((size_t) 1 << log2n) != n) {
+        return false;
+    }
+
+    fft->n = n;
+    fft->log2n = log2n;
+    fft->twiddle = NEW_ARR(float, n * 2);
+    fft->bitrev = NEW_ARR(uint32_t, n);
+
+    /* Stage `len` starts at pair len/2 - 1, after the stages before it. */
+    for (size_t len = 2; len <= n; len <<= 1) {
+        float *stage = &fft->twiddle[(len / 2 - 1) * 2];
+        for (size_t k = 0; k < len / 2; k++) {
+            double angle = -2.0 * M_PI * k / len;
+            stage[k * 2] = cos(angle);
+            stage[k * 2 + 1] = sin(angle);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t rev = 0;
+        for (int bit = 0; bit < log2n; bit++) {
+            if (i & ((size_t) 1 << bit)) {
+                rev |= 1u << (log2n - 1 - bit);
+            }
+        }
+        fft->bitrev[i] = rev;
+    }
+
+    return true;
+}
+
+void fft_free(Fft *fft) {
+    FREE(fft->twiddle);
+    FREE(fft->bitrev);
+    fft->twiddle = NULL;
+    fft->bitrev = NULL;
+    fft->n = 0;
+}
+
+void fft_forward(Fft *fft, float *data) {
+    fft_transform(fft, data, false);
+}
+
+void fft_inverse(Fft *fft, float *data) {
+    fft_transform(fft, data, true);
+
+    float scale = 1.0f / fft->n;
+    size_t i = 0;
+#ifdef FFT_SSE
+    __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= fft->n * 2; i += 4) {
+        _mm_storeu_ps(&data[i], _mm_mul_ps(_mm_loadu_ps(&data[i]), vscale));
+    }
+#endif
+    for (; i < fft->n * 2; i++) {
+        data[i] *= scale;
+    }
+}
+
+static void fft_transform(Fft *fft, float *data, bool inverse) {
+    size_t n = fft->n;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t j = fft->bitrev[i];
+        if (i < j) {
+            float re = data[i * 2];
+            float im = data[i * 2 + 1];
+            data[i * 2] = data[j * 2];
+            data[i * 2 + 1] = data[j * 2 + 1];
+            data[j * 2] = re;
+            data[j * 2 + 1] = im;
+        }
+    }
+
+    /* The inverse only differs in the sign of the twiddle's imaginary part. */
+    float sign = inverse ? -1.0f : 1.0f;
+
+#ifdef FFT_SSE
+    /* Multiplies out to the same bits as the scalar butterfly below. */
+    __m128 cross_sign = _mm_setr_ps(-sign, sign, -sign, sign);
+#endif
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        size_t half = len / 2;
+        const float *twiddle = &fft->twiddle[(half - 1) * 2];
+        for (size_t base = 0; base < n; base += len) {
+            size_t k = 0;
+#ifdef FFT_SSE
+            /* Two butterflies at a time. */
+            for (; k + 2 <= half; k += 2) {
+                __m128 w = _mm_loadu_ps(&twiddle[k * 2]);
+                __m128 w_re = _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 0, 0));
+                __m128 w_im = _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 1, 1));
+
+                float *a = &data[(base + k) * 2];
+                float *b = &data[(base + k + half) * 2];
+                __m128 va = _mm_loadu_ps(a);
+                __m128 vb = _mm_loadu_ps(b);
+                __m128 vb_swap = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1));
+
+                __m128 t = _mm_add_ps(_mm_mul_ps(vb, w_re),
+                    _mm_mul_ps(_mm_mul_ps(vb_swap, w_im), cross_sign));
+
+                _mm_storeu_ps(b, _mm_sub_ps(va, t));
+                _mm_storeu_ps(a, _mm_add_ps(va, t));
+            }
+#endif
+
+            for (; k < half; k++) {
+                float w_re = twiddle[k * 2];
+                float w_im = twiddle[k * 2 + 1] * sign;
+
+                float *a = &data[(base + k) * 2];
+                float *b = &data[(base + k + half) * 2];
+
+                float t_re = b[0] * w_re - b[1] * w_im;
+                float t_im = b[0] * w_im + b[1] * w_re;
+
+                b[0] = a[0] - t_re;
+                b[1] = a[1] - t_im;
+                a[0] += t_re;
+                a[1] += t_im;
+            }
+        }
+    }
+}
@@ -0,0 +1,892 @@
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLAC_SSE2
+#endif
+
+#include <aleph/flac.h>
+
+#define MAX_LPC_ORDER 32
+
+/* Below this a region isn't worth a task of its own. */
+#define MIN_REGION_BYTES (64 * 1024)
+#define REGIONS_PER_THREAD 4
+
+typedef struct {
+    uint32_t min_block, max_block;
+    int sample_rate, nchannels, bps;
+    uint64_t total; /* Frames (samples per channel). */
+} Flac_Info;
+
+typedef struct {
+    size_t offset, end;
+    size_t header_len;
+    uint64_t sample;
+    uint32_t block;
+    int assignment; /* Below 8 is independent channels, 8-10 are stereo pairs. */
+    int bps;
+    bool ok;
+} Flac_Frame;
+
+typedef struct {
+    Flac_Frame *frames;
+    size_t len, cap;
+} Frame_List;
+
+/* Big endian bit reader. The cache is left aligned: its top `avail` bits are
+ * the next bits of the stream. */
+typedef struct {
+    const uint8_t *data;
+    size_t len, pos;
+    uint64_t cache;
+    int avail;
+    bool error;
+} Bit_Reader;
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t first; /* Offset of the first frame. */
+    size_t region;
+    Flac_Info info;
+    float *out;
+    Frame_List *lists;
+} Flac_Decode;
+
+/* Per task decode buffer, sized for the stream's largest block. */
+typedef struct {
+    int32_t *samples; /* nchannels blocks. */
+} Flac_Scratch;
+
+static uint8_t crc8_table[256];
+/* crc16_table[k][b] is the CRC of byte b followed by k zero bytes, so eight
+ * bytes fold in with independent lookups. */
+static uint16_t crc16_table[8][256];
+static bool crc_ready = false;
+
+static bool parse_info(Flac_Info *info, const uint8_t *data, size_t len, size_t *first);
+static bool parse_header(const Flac_Info *info, const uint8_t *data, size_t len,
+    size_t offset, Flac_Frame *frame);
+static bool decode_frame(const Flac_Decode *dec, Flac_Frame *frame, Flac_Scratch *scratch);
+static bool decode_subframe(Bit_Reader *br, uint32_t block, int bps, int32_t *out);
+static bool decode_residual(Bit_Reader *br, uint32_t block, int order, int32_t *out);
+static void read_rice(Bit_Reader *br, int32_t *out, uint32_t n, uint32_t k);
+static void restore_fixed(uint32_t *out, uint32_t block, int order);
+static void restore_lpc(uint32_t *out, uint32_t block, int bps,
+    const int32_t *coefs, int order, int precision, int shift);
+static void write_frame(const Flac_Decode *dec, const Flac_Frame *frame, const Flac_Scratch *scratch);
+static void scan_frames(const Flac_Decode *dec, size_t start, size_t end, Frame_List *list);
+static void decode_region(void *ud, size_t index);
+static bool frames_chain(const Flac_Decode *dec, size_t nlists);
+static void frame_list_push(Frame_List *list, const Flac_Frame *frame);
+static void crc_init();
+static uint8_t crc8(const uint8_t *data, size_t len);
+static uint16_t crc16(const uint8_t *data, size_t len);
+
+static void br_init(Bit_Reader *br, const uint8_t *data, size_t len);
+static void br_refill(Bit_Reader *br);
+static uint32_t br_read(Bit_Reader *br, int n);
+static int32_t br_read_signed(Bit_Reader *br, int n);
+static uint32_t br_unary(Bit_Reader *br);
+static size_t br_align(Bit_Reader *br);
+static int clz64(uint64_t v);
+
+bool flac_decode(Audio_File *file, const uint8_t *data, size_t len, Worker_Pool *pool) {
+    crc_init();
+
+    Flac_Decode dec = {
+        .data = data,
+        .len = len,
+    };
+
+    if (!parse_info(&dec.info, data, len, &dec.first)) {
+        return false;
+    }
+
+    if (dec.info.total == 0) {
+        LOG_ERROR("flac streams of unknown length aren't supported");
+        return false;
+    }
+
+    size_t nchannels = dec.info.nchannels;
+    dec.out = NEW_ARR(float, dec.info.total * nchannels);
+
+    /* Regions split the stream at arbitrary bytes. Each task scans its own
+     * region for frame headers, decodes from the first one that checks out
+     * and hops frame to frame from there, so only the frame straddling the
+     * start of a region costs a short search. */
+    size_t body = len - dec.first;
+    int nthreads = pool ? workers_count(pool) : 1;
+    dec.region = body / (nthreads * REGIONS_PER_THREAD) + 1;
+    if (dec.region < MIN_REGION_BYTES) {
+        dec.region = MIN_REGION_BYTES;
+    }
+
+    size_t nregions = (body + dec.region - 1) / dec.region;
+    if (nregions == 0) {
+        nregions = 1;
+    }
+
+    dec.lists = NEW_ARR(Frame_List, nregions);
+    if (pool) {
+        workers_run(pool, nregions, decode_region, &dec);
+    } else {
+        for (size_t i = 0; i < nregions; i++) {
+            decode_region(&dec, i);
+        }
+    }
+
+    size_t nframes = 0;
+    for (size_t i = 0; i < nregions; i++) {
+        nframes += dec.lists[i].len;
+    }
+
+    /* A region can only go wrong by taking something in the middle of a
+     * frame for a header, and then only if both CRCs pass. Either way the
+     * frames wouldn't line up end to end, so redo it from the start. */
+    if (!frames_chain(&dec, nregions)) {
+        LOG_WARN("flac frames didn't chain up, decoding in order");
+
+        for (size_t i = 0; i < nregions; i++) {
+            FREE(dec.lists[i].frames);
+        }
+        FREE(dec.lists);
+
+        memset(dec.out, 0, dec.info.total * nchannels * sizeof(float));
+        dec.region = body;
+        dec.lists = NEW_ARR(Frame_List, 1);
+        decode_region(&dec, 0);
+        nregions = 1;
+        nframes = dec.lists[0].len;
+
+        if (!frames_chain(&dec, 1)) {
+            LOG_WARN("flac stream is damaged, missing frames are silent");
+        }
+    }
+
+    LOG_DEBUG_FMT("decoded %d flac frames in %d regions", (int) nframes, (int) nregions);
+
+    for (size_t i = 0; i < nregions; i++) {
+        FREE(dec.lists[i].frames);
+    }
+    FREE(dec.lists);
+
+    file->sample_t = SAMPLE_TYPE_F32;
+    file->nchannels = dec.info.nchannels;
+    file->sample_rate = dec.info.sample_rate;
+    file->len = dec.info.total * nchannels;
+    file->data.f32 = dec.out;
+
+    return true;
+}
+
+static void decode_region(void *ud, size_t index) {
+    Flac_Decode *dec = ud;
+
+    size_t start = dec->first + index * dec->region;
+    size_t end = start + dec->region;
+    if (end > dec->len) {
+        end = dec->len;
+    }
+
+    scan_frames(dec, start, end, &dec->lists[index]);
+}
+
+static void scan_frames(const Flac_Decode *dec, size_t start, size_t end, Frame_List *list) {
+    Flac_Scratch scratch;
+    scratch.samples = NEW_ARR(int32_t, (size_t) dec->info.max_block * dec->info.nchannels);
+
+    size_t offset = start;
+    while (offset < end) {
+        const uint8_t *sync = memchr(dec->data + offset, 0xFF, end - offset);
+        if (!sync) {
+            break;
+        }
+
+        offset = sync - dec->data;
+
+        Flac_Frame frame;
+        if (parse_header(&dec->info, dec->data, dec->len, offset, &frame)) {
+            frame.ok = decode_frame(dec, &frame, &scratch);
+            if (frame.ok) {
+                write_frame(dec, &frame, &scratch);
+                frame_list_push(list, &frame);
+                offset = frame.end;
+                continue;
+            }
+        }
+
+        offset++;
+    }
+
+    FREE(scratch.samples);
+}
+
+/* Checks the frames found are exactly the stream: each starting where the
+ * last ended, and together covering every sample once. */
+static bool frames_chain(const Flac_Decode *dec, size_t nlists) {
+    size_t expect = dec->first;
+    uint64_t sample = 0;
+
+    for (size_t i = 0; i < nlists; i++) {
+        Frame_List *list = &dec->lists[i];
+        for (size_t j = 0; j < list->len; j++) {
+            Flac_Frame *frame = &list->frames[j];
+            if (frame->offset != expect || frame->sample != sample) {
+                return false;
+            }
+
+            expect = frame->end;
+            sample += frame->block;
+        }
+    }
+
+    return sample == dec->info.total;
+}
+
+static void frame_list_push(Frame_List *list, const Flac_Frame *frame) {
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        Flac_Frame *frames = NEW_ARR(Flac_Frame, cap);
+        if (list->len) {
+            memcpy(frames, list->frames, list->len * sizeof(Flac_Frame));
+        }
+        FREE(list->frames);
+        list->frames = frames;
+        list->cap = cap;
+    }
+
+    list->frames[list->len++] = *frame;
+}
+
+static bool parse_info(Flac_Info *info, const uint8_t *data, size_t len, size_t *first) {
+    if (len < 8 || memcmp(data, "fLaC", 4) != 0) {
+        return false;
+    }
+
+    bool have_info = false;
+    size_t offset = 4;
+    for (;;) {
+        if (offset + 4 > len) {
+            return false;
+        }
+
+        bool last = data[offset] & 0x80;
+        int type = data[offset] & 0x7F;
+        size_t block_len = ((size_t) data[offset + 1] << 16)
+            | ((size_t) data[offset + 2] << 8) | data[offset + 3];
+        offset += 4;
+
+        if (offset + block_len > len) {
+            return false;
+        }
+
+        if (type == 0 && block_len >= 34) {
+            Bit_Reader br;
+            br_init(&br, data + offset, block_len);
+            info->min_block = br_read(&br, 16);
+            info->max_block = br_read(&br, 16);
+            br_read(&br, 24);
+            br_read(&br, 24);
+            info->sample_rate = br_read(&br, 20);
+            info->nchannels = br_read(&br, 3) + 1;
+            info->bps = br_read(&br, 5) + 1;
+            info->total = (uint64_t) br_read(&br, 4) << 32;
+            info->total |= br_read(&br, 32);
+            have_info = true;
+        }
+
+        offset += block_len;
+        if (last) {
+            break;
+        }
+    }
+
+    if (!have_info) {
+        LOG_ERROR("flac stream has no STREAMINFO");
+        return false;
+    }
+
+    if (info->bps > 24 || info->bps < 4 || info->max_block < 16) {
+        LOG_ERROR_FMT("unsupported flac stream: %d bits, block size %d",
+            info->bps, (int) info->max_block);
+        return false;
+    }
+
+    *first = offset;
+    return true;
+}
+
+static bool parse_header(const Flac_Info *info, const uint8_t *data, size_t len,
+    size_t offset, Flac_Frame *frame) {
+    /* The longest header: sync, codes, 7 byte number, 16 bit block size,
+     * 16 bit sample rate and the CRC. */
+    uint8_t p[16];
+    size_t avail = len - offset < sizeof(p) ? len - offset : sizeof(p);
+    if (avail < 6) {
+        return false;
+    }
+    memset(p, 0, sizeof(p));
+    memcpy(p, data + offset, avail);
+
+    if (p[0] != 0xFF || (p[1] & 0xFE) != 0xF8 || (p[3] & 1)) {
+        return false;
+    }
+
+    bool variable = p[1] & 1;
+    int block_code = p[2] >> 4;
+    int rate_code = p[2] & 0xF;
+    int assignment = p[3] >> 4;
+    int size_code = (p[3] >> 1) & 7;
+
+    static const int sizes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+    int bps = size_code == 0 ? info->bps : sizes[size_code];
+    int nchannels = assignment < 8 ? assignment + 1 : 2;
+
+    if (block_code == 0 || rate_code == 0xF || assignment > 10 || bps != info->bps
+        || nchannels != info->nchannels) {
+        return false;
+    }
+
+    size_t i = 4;
+    uint64_t number = p[i++];
+    if (number & 0x80) {
+        int extra = 0;
+        while (extra < 7 && (number & (0x40 >> extra))) {
+            extra++;
+        }
+        if (extra == 0 || extra > 6) {
+            return false;
+        }
+
+        number &= 0x3F >> extra;
+        for (int j = 0; j < extra; j++) {
+            if ((p[i] & 0xC0) != 0x80) {
+                return false;
+            }
+            number = (number << 6) | (p[i++] & 0x3F);
+        }
+    }
+
+    uint32_t block;
+    if (block_code == 1) {
+        block = 192;
+    } else if (block_code <= 5) {
+        block = 576u << (block_code - 2);
+    } else if (block_code == 6) {
+        block = p[i++] + 1;
+    } else if (block_code == 7) {
+        block = ((p[i] << 8) | p[i + 1]) + 1;
+        i += 2;
+    } else {
+        block = 256u << (block_code - 8);
+    }
+
+    if (rate_code == 12) {
+        i += 1;
+    } else if (rate_code == 13 || rate_code == 14) {
+        i += 2;
+    }
+
+    if (i >= avail || crc8(p, i) != p[i]) {
+        return false;
+    }
+
+    frame->sample = variable ? number : number * info->max_block;
+    if (block > info->max_block || frame->sample + block > info->total) {
+        return false;
+    }
+
+    frame->offset = offset;
+    frame->header_len = i + 1;
+    frame->block = block;
+    frame->assignment = assignment;
+    frame->bps = bps;
+    frame->ok = false;
+
+    return true;
+}
+
+static bool decode_frame(const Flac_Decode *dec, Flac_Frame *frame, Flac_Scratch *scratch) {
+    size_t start = frame->offset + frame->header_len;
+    Bit_Reader br;
+    br_init(&br, dec->data + start, dec->len - start);
+
+    uint32_t block = frame->block;
+    int nchannels = dec->info.nchannels;
+
+    for (int chan = 0; chan < nchannels; chan++) {
+        /* The side channel of a stereo pair needs an extra bit. */
+        int bps = frame->bps;
+        if ((frame->assignment == 8 && chan == 1) || (frame->assignment == 9 && chan == 0)
+            || (frame->assignment == 10 && chan == 1)) {
+            bps++;
+        }
+
+        if (!decode_subframe(&br, block, bps, &scratch->samples[chan * block])) {
+            return false;
+        }
+    }
+
+    size_t end = start + br_align(&br);
+    if (end + 2 > dec->len) {
+        return false;
+    }
+
+    uint16_t crc = (dec->data[end] << 8) | dec->data[end + 1];
+    if (crc16(dec->data + frame->offset, end - frame->offset) != crc) {
+        return false;
+    }
+    frame->end = end + 2;
+
+    /* Corrupt input can take the sums past 32 bits, here and in the
+     * predictors, so they are done unsigned to wrap rather than overflow. */
+    uint32_t *a = (uint32_t *) scratch->samples;
+    uint32_t *b = (uint32_t *) scratch->samples + block;
+    switch (frame->assignment) {
+        case 8: /* Left, side. */
+            for (uint32_t i = 0; i < block; i++) {
+                b[i] = a[i] - b[i];
+            }
+            break;
+        case 9: /* Side, right. */
+            for (uint32_t i = 0; i < block; i++) {
+                a[i] += b[i];
+            }
+            break;
+        case 10: /* Mid, side. */
+            for (uint32_t i = 0; i < block; i++) {
+                uint32_t mid = (a[i] << 1) | (b[i] & 1);
+                uint32_t side = b[i];
+                a[i] = (int32_t) (mid + side) >> 1;
+                b[i] = (int32_t) (mid - side) >> 1;
+            }
+            break;
+    }
+
+    return true;
+}
+
+static bool decode_subframe(Bit_Reader *br, uint32_t block, int bps, int32_t *out) {
+    if (br_read(br, 1) != 0) {
+        return false;
+    }
+
+    int type = br_read(br, 6);
+    int wasted = 0;
+    if (br_read(br, 1)) {
+        wasted = br_unary(br) + 1;
+        bps -= wasted;
+        if (bps <= 0) {
+            return false;
+        }
+    }
+
+    if (type == 0) {
+        int32_t value = br_read_signed(br, bps);
+        for (uint32_t i = 0; i < block; i++) {
+            out[i] = value;
+        }
+    } else if (type == 1) {
+        for (uint32_t i = 0; i < block; i++) {
+            out[i] = br_read_signed(br, bps);
+        }
+    } else if (type >= 8 && type <= 12) {
+        int order = type - 8;
+        if ((uint32_t) order > block) {
+            return false;
+        }
+
+        for (int i = 0; i < order; i++) {
+            out[i] = br_read_signed(br, bps);
+        }
+        if (!decode_residual(br, block, order, out)) {
+            return false;
+        }
+        restore_fixed((uint32_t *) out, block, order);
+    } else if (type >= 32) {
+        int order = type - 31;
+        if ((uint32_t) order > block) {
+            return false;
+        }
+
+        for (int i = 0; i < order; i++) {
+            out[i] = br_read_signed(br, bps);
+        }
+
+        int precision = br_read(br, 4) + 1;
+        int shift = br_read_signed(br, 5);
+        if (precision == 16 || shift < 0) {
+            return false;
+        }
+
+        int32_t coefs[MAX_LPC_ORDER];
+        for (int i = 0; i < order; i++) {
+            coefs[i] = br_read_signed(br, precision);
+        }
+
+        if (!decode_residual(br, block, order, out)) {
+            return false;
+        }
+        restore_lpc((uint32_t *) out, block, bps, coefs, order, precision, shift);
+    } else {
+        return false;
+    }
+
+    if (wasted) {
+        for (uint32_t i = 0; i < block; i++) {
+            out[i] = (uint32_t) out[i] << wasted;
+        }
+    }
+
+    return !br->error;
+}
+
+static bool decode_residual(Bit_Reader *br, uint32_t block, int order, int32_t *out) {
+    int method = br_read(br, 2);
+    if (method > 1) {
+        return false;
+    }
+
+    int param_bits = method ? 5 : 4;
+    uint32_t escape = method ? 31 : 15;
+    int partition_order = br_read(br, 4);
+    uint32_t nparts = 1u << partition_order;
+    uint32_t part_len = block >> partition_order;
+
+    if ((part_len << partition_order) != block || part_len < (uint32_t) order) {
+        return false;
+    }
+
+    uint32_t i = order;
+    for (uint32_t part = 0; part < nparts; part++) {
+        uint32_t end = (part + 1) * part_len;
+        uint32_t k = br_read(br, param_bits);
+
+        if (k == escape) {
+            int bits = br_read(br, 5);
+            for (; i < end; i++) {
+                out[i] = br_read_signed(br, bits);
+            }
+        } else {
+            read_rice(br, &out[i], end - i, k);
+            i = end;
+        }
+
+        if (br->error) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* The bulk of a FLAC stream. Works on a local copy of the reader so the
+ * cache stays in registers, refilling it at most once per value for the
+ * usual short quotients. */
+static void read_rice(Bit_Reader *br, int32_t *out, uint32_t n, uint32_t k) {
+    const uint8_t *data = br->data;
+    size_t len = br->len, pos = br->pos;
+    uint64_t cache = br->cache;
+    int avail = br->avail;
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (avail <= 56) {
+            while (avail <= 56 && pos < len) {
+                cache |= (uint64_t) data[pos++] << (56 - avail);
+                avail += 8;
+            }
+        }
+
+        uint32_t q = 0;
+        if (cache != 0 && (int) clz64(cache) + 1 + (int) k <= avail) {
+            int zeros = clz64(cache);
+            q = zeros;
+            cache <<= zeros + 1;
+            avail -= zeros + 1;
+        } else {
+            /* Long run of zeros or the end of the stream: the slow path. */
+            br->pos = pos;
+            br->cache = cache;
+            br->avail = avail;
+            q = br_unary(br);
+            if (br->avail < (int) k) {
+                br_refill(br);
+            }
+            pos = br->pos;
+            cache = br->cache;
+            avail = br->avail;
+            if (avail < (int) k) {
+                br->error = true;
+                return;
+            }
+        }
+
+        uint32_t value = q << k;
+        if (k) {
+            value |= (uint32_t) (cache >> (64 - k));
+            cache <<= k;
+            avail -= k;
+        }
+
+        out[i] = (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+    }
+
+    br->pos = pos;
+    br->cache = cache;
+    br->avail = avail;
+}
+
+static void restore_fixed(uint32_t *out, uint32_t block, int order) {
+    switch (order) {
+        case 1:
+            for (uint32_t i = 1; i < block; i++) {
+                out[i] += out[i - 1];
+            }
+            break;
+        case 2:
+            for (uint32_t i = 2; i < block; i++) {
+                out[i] += 2 * out[i - 1] - out[i - 2];
+            }
+            break;
+        case 3:
+            for (uint32_t i = 3; i < block; i++) {
+                out[i] += 3 * out[i - 1] - 3 * out[i - 2] + out[i - 3];
+            }
+            break;
+        case 4:
+            for (uint32_t i = 4; i < block; i++) {
+                out[i] += 4 * out[i - 1] - 6 * out[i - 2] + 4 * out[i - 3] - out[i - 4];
+            }
+            break;
+    }
+}
+
+static int ilog2(uint32_t v) {
+    int log = 0;
+    while (v >>= 1) {
+        log++;
+    }
+    return log;
+}
+
+/* Each sample depends on the ones before it, so the vector work is across
+ * the taps of one prediction: samples that fit in 16 bits are predicted
+ * eight taps per multiply-add. */
+static void restore_lpc(uint32_t *out, uint32_t block, int bps,
+    const int32_t *coefs, int order, int precision, int shift) {
+    /* Encoders pick a precision that keeps the sums in 32 bits for the bit
+     * depths they're given; anything that doesn't has to go wide. */
+    if (bps + precision + ilog2(order) > 32) {
+        for (uint32_t i = order; i < block; i++) {
+            int64_t sum = 0;
+            for (int j = 0; j < order; j++) {
+                sum += (int64_t) coefs[j] * (int32_t) out[i - 1 - j];
+            }
+            out[i] += (uint32_t) (sum >> shift);
+        }
+        return;
+    }
+
+    uint32_t i = order;
+
+#ifdef FLAC_SSE2
+    if (bps <= 16 && order <= 16) {
+        /* The last 16 samples stay in two registers, oldest in the low lane
+         * of `old`, and shift along as each one is predicted: reloading
+         * them from memory right after a store would stall on every
+         * sample. Taps are reversed to match and zero padded. */
+        int16_t rev[16] = {0};
+        for (int j = 0; j < order; j++) {
+            rev[15 - j] = (int16_t) coefs[j];
+        }
+        __m128i c_old = _mm_loadu_si128((const __m128i *) &rev[0]);
+        __m128i c_new = _mm_loadu_si128((const __m128i *) &rev[8]);
+
+        int16_t start[16] = {0};
+        for (int j = 0; j < order; j++) {
+            start[16 - order + j] = (int16_t) out[j];
+        }
+        __m128i old = _mm_loadu_si128((const __m128i *) &start[0]);
+        __m128i new = _mm_loadu_si128((const __m128i *) &start[8]);
+
+        for (; i < block; i++) {
+            __m128i acc = _mm_add_epi32(_mm_madd_epi16(old, c_old), _mm_madd_epi16(new, c_new));
+            acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+            acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+
+            uint32_t sample = out[i] + (_mm_cvtsi128_si32(acc) >> shift);
+            out[i] = sample;
+
+            old = _mm_or_si128(_mm_srli_si128(old, 2), _mm_slli_si128(new, 14));
+            new = _mm_insert_epi16(_mm_srli_si128(new, 2), sample, 7);
+        }
+        return;
+    }
+#endif
+
+    for (; i < block; i++) {
+        uint32_t sum = 0;
+        for (int j = 0; j < order; j++) {
+            sum += coefs[j] * out[i - 1 - j];
+        }
+        out[i] += (int32_t) sum >> shift;
+    }
+}
+
+static void write_frame(const Flac_Decode *dec, const Flac_Frame *frame, const Flac_Scratch *scratch) {
+    int nchannels = dec->info.nchannels;
+    float scale = 1.0f / (float) (1 << (frame->bps - 1));
+    float *out = &dec->out[frame->sample * nchannels];
+
+    for (int chan = 0; chan < nchannels; chan++) {
+        const int32_t *in = &scratch->samples[chan * frame->block];
+        for (uint32_t i = 0; i < frame->block; i++) {
+            out[i * nchannels + chan] = in[i] * scale;
+        }
+    }
+}
+
+static void crc_init() {
+    if (crc_ready) {
+        return;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        uint8_t c8 = i;
+        uint16_t c16 = i << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1;
+            c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1;
+        }
+        crc8_table[i] = c8;
+        crc16_table[0][i] = c16;
+    }
+
+    for (int k = 1; k < 8; k++) {
+        for (int i = 0; i < 256; i++) {
+            uint16_t prev = crc16_table[k - 1][i];
+            crc16_table[k][i] = (prev << 8) ^ crc16_table[0][prev >> 8];
+        }
+    }
+
+    crc_ready = true;
+}
+
+static uint8_t crc8(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc8_table[crc ^ data[i]];
+    }
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        const uint8_t *p = &data[i];
+        crc = crc16_table[7][(crc >> 8) ^ p[0]] ^ crc16_table[6][(crc & 0xFF) ^ p[1]]
+            ^ crc16_table[5][p[2]] ^ crc16_table[4][p[3]]
+            ^ crc16_table[3][p[4]] ^ crc16_table[2][p[5]]
+            ^ crc16_table[1][p[6]] ^ crc16_table[0][p[7]];
+    }
+
+    for (; i < len; i++) {
+        crc = (crc << 8) ^ crc16_table[0][(crc >> 8) ^ data[i]];
+    }
+    return crc;
+}
+
+/* Leading zeros of a non-zero value. */
+static int clz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_clzll(v);
+#else
+    int zeros = 0;
+    while (!(v & ((uint64_t) 1 << (63 - zeros)))) {
+        zeros++;
+    }
+    return zeros;
+#endif
+}
+
+static void br_init(Bit_Reader *br, const uint8_t *data, size_t len) {
+    br->data = data;
+    br->len = len;
+    br->pos = 0;
+    br->cache = 0;
+    br->avail = 0;
+    br->error = false;
+}
+
+static void br_refill(Bit_Reader *br) {
+    while (br->avail <= 56 && br->pos < br->len) {
+        br->cache |= (uint64_t) br->data[br->pos++] << (56 - br->avail);
+        br->avail += 8;
+    }
+}
+
+/* Reads n <= 32 bits. */
+static uint32_t br_read(Bit_Reader *br, int n) {
+    if (n == 0) {
+        return 0;
+    }
+
+    if (br->avail < n) {
+        br_refill(br);
+        if (br->avail < n) {
+            br->error = true;
+            return 0;
+        }
+    }
+
+    uint32_t value = (uint32_t) (br->cache >> (64 - n));
+    br->cache <<= n;
+    br->avail -= n;
+    return value;
+}
+
+static int32_t br_read_signed(Bit_Reader *br, int n) {
+    if (n == 0) {
+        return 0;
+    }
+
+    uint32_t value = br_read(br, n);
+    return (int32_t) (value << (32 - n)) >> (32 - n);
+}
+
+/* Counts zero bits up to and past the next one bit. */
+static uint32_t br_unary(Bit_Reader *br) {
+    uint32_t count = 0;
+    for (;;) {
+        if (br->avail == 0) {
+            br_refill(br);
+            if (br->avail == 0) {
+                br->error = true;
+                return 0;
+            }
+        }
+
+        if (br->cache == 0) {
+            count += br->avail;
+            br->avail = 0;
+            continue;
+        }
+
+        int zeros = clz64(br->cache);
+        count += zeros;
+        br->cache = zeros == 63 ? 0 : br->cache << (zeros + 1);
+        br->avail -= zeros + 1;
+        return count;
+    }
+}
+
+/* Skips to the next byte, returning how many bytes have been read. */
+static size_t br_align(Bit_Reader *br) {
+    int drop = br->avail % 8;
+    br->cache <<= drop;
+    br->avail -= drop;
+    return br->pos - br->avail / 8;
+}
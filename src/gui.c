@@ -1,3 +1,6 @@
+#include <math.h>
+#include <stdio.h>
+
 #include <SDL.h>
 
 #include <GL/glew.h>
@@ -6,6 +9,7 @@
 #include <aleph/shader.h>
 #include <aleph/audio.h>
 #include <aleph/gui.h>
+#include <aleph/spectrogram.h>
 
 #define BUTTON_LEFT 0 
 #define BUTTON_RIGHT 1
@@ -24,6 +28,8 @@ typedef enum {
     KEY_9,
 
     KEY_SPACE,
+    KEY_TAB,
+    KEY_E,
 
     KEY_SHIFT,
     KEY_ESC,
@@ -39,6 +45,11 @@ typedef enum {
     SLICE_FINISHED,
 } Slice_State;
 
+typedef enum {
+    VIEW_WAVEFORM,
+    VIEW_SPECTROGRAM,
+} View;
+
 typedef struct {
     Slice_Id id;
     Slice_State state;
@@ -49,11 +60,21 @@ typedef struct {
 
 #define MAX_SLICES 10
 
+/* The cursor snaps to the quietest zero crossing this close on screen. */
+#define SNAP_RADIUS_PX 4
+
+/* Meters show -60dBFS to +6dBFS. */
+#define METER_FLOOR_DB -60.0f
+#define METER_CEIL_DB 6.0f
+#define CLIP_HOLD_MS 2000
+
 struct {
     SDL_Window *win;
     int win_w, win_h;
     bool running;
+    bool drawn;
     Shader shader;
+    View view;
 
     size_t zoom, start;
     size_t old_zoom, old_start;
@@ -73,6 +94,15 @@ struct {
     bool key_released[_KEY_MAX];
     bool key_down[_KEY_MAX];
 
+    uint32_t master_clips;
+    Uint32 clip_until;
+
+    float lufs; /* New slices are evened out to the file's loudness. */
+
+    /* Exports run on a thread of their own; the title says how it went. */
+    SDL_Thread *export_thread;
+    SDL_atomic_t export_done;
+    size_t exported;
 } gui;
 
 typedef struct {
@@ -81,11 +111,21 @@ typedef struct {
 
 Vec3 cursor_color = {0.72156862745, 0.72156862745, 0.56078431372};
 Vec3 slice_color = {1.0f, 1.0f, 1.0f};
+Vec3 rms_color = {0.3f, 0.7f, 0.3f};
+Vec3 peak_color = {0.9f, 0.8f, 0.2f};
+Vec3 clip_color = {0.9f, 0.1f, 0.1f};
 
 static int sdl_button_to_num(int button);
 static int sdl_key_to_num(int key);
 static void draw_marker(size_t index, Vec3 color);
 static void gui_get_input();
+static void draw_waveform();
+static void draw_meters();
+static void draw_meter(const Meter_Level *level, float x, float w, bool clip);
+static float meter_y(float level);
+static void export_start();
+static void export_poll();
+static int export_thread(void *ud);
 
 void gui_init() {
     gui.win_w = 960;
@@ -112,6 +152,25 @@ void gui_init() {
 
     gui.start = 0;
     gui.zoom = 256;
+
+    gui.view = VIEW_WAVEFORM;
+}
+
+void gui_start() {
+    const Audio_File *file = audio_get_file();
+    size_t frames = file->len / file->nchannels;
+    gui.lufs = loudness_measure(audio_get_loudness(), 0, frames ? frames - 1 : 0).lufs;
+
+    spectrogram_init(file);
+}
+
+void gui_free() {
+    if (gui.export_thread) {
+        SDL_WaitThread(gui.export_thread, NULL);
+        gui.export_thread = NULL;
+    }
+
+    spectrogram_free();
 }
 
 bool gui_is_running() {
@@ -120,6 +179,7 @@ bool gui_is_running() {
 
 void gui_update() {
     gui_get_input();
+    export_poll();
 
     if (gui.button_pressed[BUTTON_RIGHT]) {
         gui.down_x = gui.mouse_x;
@@ -144,7 +204,15 @@ void gui_update() {
     if (gui.button_down[BUTTON_LEFT]) {
         float pixels_from_start = gui.mouse_x - 100.0f;
         float jump_index = (pixels_from_start + gui.start) * gui.zoom;
-        gui.cursor_index = jump_index;
+        gui.cursor_index = snap_quiet(audio_get_snap(), jump_index, gui.zoom * SNAP_RADIUS_PX);
+    }
+
+    if (gui.key_pressed[KEY_TAB]) {
+        gui.view = gui.view == VIEW_WAVEFORM ? VIEW_SPECTROGRAM : VIEW_WAVEFORM;
+    }
+
+    if (gui.key_pressed[KEY_E]) {
+        export_start();
     }
 
     if (gui.key_pressed[KEY_SPACE]) {
@@ -162,6 +230,7 @@ void gui_update() {
                     slice->start = gui.cursor_index;
                 }
                 slice->id = audio_slice_begin(slice->start, slice->end, false);
+                audio_slice_normalize(slice->id, gui.lufs);
                 break;
             case SLICE_FINISHED:
                 break;
@@ -209,8 +278,49 @@ void gui_draw() {
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
+    size_t view_w = gui.win_w - 200;
+    if (gui.view == VIEW_SPECTROGRAM) {
+        spectrogram_draw(gui.start, gui.zoom, view_w, 
+            (100.0f / gui.win_w) * 2.0f - 1.0f, 
+            ((100.0f + view_w) / gui.win_w) * 2.0f - 1.0f, -0.8f, 0.8f);
+    }
+
     glBegin(GL_LINES);
 
+    if (gui.view == VIEW_WAVEFORM) {
+        draw_waveform();
+    }
+
+    for (int i = 0; i < MAX_SLICES; i++) {
+        Slice *slice = &gui.slices[i];
+        switch (slice->state) {
+            case SLICE_EMPTY:
+                break;
+            case SLICE_FIRST_MARK:
+                draw_marker(slice->start, slice_color);
+                break;
+            case SLICE_FINISHED:
+                draw_marker(slice->start, slice_color);
+                draw_marker(slice->end, slice_color);
+                break;
+        }
+    }
+
+    draw_marker(gui.cursor_index, cursor_color);
+
+    glEnd();
+
+    draw_meters();
+
+    SDL_GL_SwapWindow(gui.win);
+
+    if (!gui.drawn) {
+        gui.drawn = true;
+        LOG("first frame drawn");
+    }
+}
+
+static void draw_waveform() {
     size_t len = 0;
     float *data = audio_get_file_data(&len);
 
@@ -258,27 +368,75 @@ void gui_draw() {
         glVertex2f(x, -0.5f);
         glVertex2f(x, -0.5 + right_sample_neg);
     }
+}
+
+static void draw_meters() {
+    const Audio_Meters *meters = audio_read_meters();
+
+    if (meters->master.clips != gui.master_clips) {
+        gui.master_clips = meters->master.clips;
+        gui.clip_until = SDL_GetTicks() + CLIP_HOLD_MS;
+    }
+
+    bool clip = SDL_GetTicks() < gui.clip_until;
+    draw_meter(&meters->master, gui.win_w - 70.0f, 40.0f, clip);
 
     for (int i = 0; i < MAX_SLICES; i++) {
         Slice *slice = &gui.slices[i];
-        switch (slice->state) {
-            case SLICE_EMPTY:
-                break;
-            case SLICE_FIRST_MARK:
-                draw_marker(slice->start, slice_color);
-                break;
-            case SLICE_FINISHED:
-                draw_marker(slice->start, slice_color);
-                draw_marker(slice->end, slice_color);
-                break;
+        if (slice->state == SLICE_FINISHED) {
+            draw_meter(&meters->chans[slice->id], 5.0f + i * 9.0f, 8.0f, false);
         }
     }
+}
 
-    draw_marker(gui.cursor_index, cursor_color);
+/* Left and right bars side by side: RMS filled, peak and true peak as
+ * lines, the true peak in red once it's over full scale. */
+static void draw_meter(const Meter_Level *level, float x, float w, bool clip) {
+    float zero_y = meter_y(1.0f);
+
+    for (int c = 0; c < 2; c++) {
+        float x0 = ((x + c * w / 2) / gui.win_w) * 2.0f - 1.0f;
+        float x1 = ((x + (c + 1) * w / 2 - 1.0f) / gui.win_w) * 2.0f - 1.0f;
+
+        glBegin(GL_QUADS);
+        glColor3f(rms_color.x, rms_color.y, rms_color.z);
+        glVertex2f(x0, -0.8f);
+        glVertex2f(x1, -0.8f);
+        glVertex2f(x1, meter_y(level->rms[c]));
+        glVertex2f(x0, meter_y(level->rms[c]));
+
+        if (clip) {
+            glColor3f(clip_color.x, clip_color.y, clip_color.z);
+            glVertex2f(x0, 0.82f);
+            glVertex2f(x1, 0.82f);
+            glVertex2f(x1, 0.86f);
+            glVertex2f(x0, 0.86f);
+        }
+        glEnd();
+
+        glBegin(GL_LINES);
+        glColor3f(peak_color.x, peak_color.y, peak_color.z);
+        glVertex2f(x0, meter_y(level->peak[c]));
+        glVertex2f(x1, meter_y(level->peak[c]));
+
+        Vec3 tp_color = level->true_peak[c] > 1.0f ? clip_color : slice_color;
+        glColor3f(tp_color.x, tp_color.y, tp_color.z);
+        glVertex2f(x0, meter_y(level->true_peak[c]));
+        glVertex2f(x1, meter_y(level->true_peak[c]));
+
+        glColor3f(cursor_color.x, cursor_color.y, cursor_color.z);
+        glVertex2f(x0, zero_y);
+        glVertex2f(x1, zero_y);
+        glEnd();
+    }
+}
 
-    glEnd();
+static float meter_y(float level) {
+    float db = level > 0.0f ? 20.0f * log10f(level) : METER_FLOOR_DB;
+    if (db < METER_FLOOR_DB) db = METER_FLOOR_DB;
+    if (db > METER_CEIL_DB) db = METER_CEIL_DB;
 
-    SDL_GL_SwapWindow(gui.win);
+    return -0.8f + (db - METER_FLOOR_DB) / (METER_CEIL_DB - METER_FLOOR_DB) * 1.6f;
 }
 
 static void draw_marker(size_t index, Vec3 color) {
@@ -388,6 +546,10 @@ static int sdl_key_to_num(int key) {
             return KEY_9;
         case SDLK_SPACE:
             return KEY_SPACE;
+        case SDLK_TAB:
+            return KEY_TAB;
+        case SDLK_e:
+            return KEY_E;
         case SDLK_LSHIFT:
             return KEY_SHIFT;
         case SDLK_ESCAPE:
@@ -395,4 +557,36 @@ static int sdl_key_to_num(int key) {
         default:
             return -1;
     }
-}
\ No newline at end of file
+}
+
+/* One export at a time; E during one does nothing. */
+static void export_start() {
+    if (gui.export_thread) {
+        return;
+    }
+
+    SDL_AtomicSet(&gui.export_done, 0);
+    SDL_SetWindowTitle(gui.win, "aleph - exporting slices...");
+    gui.export_thread = SDL_CreateThread(export_thread, "export", NULL);
+}
+
+static void export_poll() {
+    if (!gui.export_thread || !SDL_AtomicGet(&gui.export_done)) {
+        return;
+    }
+
+    SDL_WaitThread(gui.export_thread, NULL);
+    gui.export_thread = NULL;
+
+    char title[64];
+    snprintf(title, sizeof(title), "aleph - exported %d slices", (int) gui.exported);
+    SDL_SetWindowTitle(gui.win, title);
+}
+
+static int export_thread(void *ud) {
+    IGNORE(ud);
+
+    gui.exported = audio_export_slices(".");
+    SDL_AtomicSet(&gui.export_done, 1);
+    return 0;
+}
\ No newline at end of file
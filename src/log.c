@@ -0,0 +1,511 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include <SDL.h>
+
+#include <aleph/log.h>
+
+#define MAX_LOG_THREADS 32
+#define LOG_RING_SIZE 512 /* Records per thread, must be a power of two. */
+#define LOG_MAX_ARGS 8
+#define LOG_STR_BYTES 96
+#define LOG_MSG_BYTES 512
+#define LOG_DRAIN_MS 10
+
+/* Arguments are captured raw; the format string is only walked far enough
+ * to know their types, and is applied later on the drain thread. Strings are
+ * copied into the record since the caller's buffer may be gone by then. */
+typedef struct {
+    uint64_t time;
+    const char *fmt;
+    const char *file;
+    int line;
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t str_len;
+    uint64_t args[LOG_MAX_ARGS];
+    char strs[LOG_STR_BYTES];
+} Log_Record;
+
+/* Single producer (the owning thread), single consumer (whoever holds the
+ * drain lock). When full, new records are counted and dropped. */
+typedef struct {
+    SDL_atomic_t head, tail;
+    SDL_atomic_t dropped;
+    Log_Record records[LOG_RING_SIZE];
+} Log_Ring;
+
+typedef enum {
+    LEN_NONE,
+    LEN_HH,
+    LEN_H,
+    LEN_L,
+    LEN_LL,
+    LEN_Z,
+    LEN_J,
+    LEN_T,
+    LEN_BIG_L,
+} Log_Length;
+
+typedef struct {
+    char conv;
+    Log_Length length;
+    bool star_width, star_prec;
+} Log_Spec;
+
+struct {
+    Log_Ring rings[MAX_LOG_THREADS];
+    SDL_atomic_t nrings;
+    SDL_atomic_t level;
+    SDL_atomic_t running;
+    SDL_Thread *thread;
+    SDL_mutex *drain_lock;
+    Uint64 start_time;
+} log_sys;
+
+static THREAD_LOCAL int thread_ring_slot = 0;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static int log_thread(void *ud);
+static void log_drain();
+static Log_Ring *log_thread_ring();
+static const char *spec_parse(const char *p, Log_Spec *spec);
+static void record_fill(Log_Record *rec, const char *fmt, va_list args);
+static void record_print(const Log_Record *rec);
+static int format_arg(char *out, size_t cap, const char *one,
+    const Log_Spec *spec, uint64_t value, const int *star, int nstar,
+    const Log_Record *rec);
+
+void log_init() {
+    log_sys.drain_lock = SDL_CreateMutex();
+    log_sys.start_time = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&log_sys.level, LOG_LEVEL_INFO);
+    SDL_AtomicSet(&log_sys.running, 1);
+    log_sys.thread = SDL_CreateThread(log_thread, "log", NULL);
+}
+
+void log_shutdown() {
+    if (!SDL_AtomicGet(&log_sys.running)) {
+        return;
+    }
+
+    SDL_AtomicSet(&log_sys.running, 0);
+    SDL_WaitThread(log_sys.thread, NULL);
+    log_sys.thread = NULL;
+}
+
+void log_flush() {
+    if (log_sys.drain_lock) {
+        log_drain();
+    }
+}
+
+void log_set_level(Log_Level level) {
+    SDL_AtomicSet(&log_sys.level, level);
+}
+
+void _log(Log_Level level, const char *fmt, const char *file, int line, ...) {
+    if ((int) level < SDL_AtomicGet(&log_sys.level)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, line);
+
+    Log_Ring *ring = SDL_AtomicGet(&log_sys.running) ? log_thread_ring() : NULL;
+    if (!ring) {
+        Log_Record rec;
+        rec.time = log_sys.start_time ? SDL_GetPerformanceCounter() : 0;
+        rec.fmt = fmt;
+        rec.file = file;
+        rec.line = line;
+        rec.level = level;
+        record_fill(&rec, fmt, args);
+        record_print(&rec);
+        va_end(args);
+        return;
+    }
+
+    int head = SDL_AtomicGet(&ring->head);
+    int tail = SDL_AtomicGet(&ring->tail);
+    if ((unsigned) (head - tail) >= LOG_RING_SIZE) {
+        SDL_AtomicAdd(&ring->dropped, 1);
+        va_end(args);
+        return;
+    }
+
+    Log_Record *rec = &ring->records[((unsigned) head) & (LOG_RING_SIZE - 1)];
+    rec->time = SDL_GetPerformanceCounter();
+    rec->fmt = fmt;
+    rec->file = file;
+    rec->line = line;
+    rec->level = level;
+    record_fill(rec, fmt, args);
+
+    SDL_AtomicSet(&ring->head, head + 1);
+
+    va_end(args);
+}
+
+static int log_thread(void *ud) {
+    IGNORE(ud);
+
+    while (SDL_AtomicGet(&log_sys.running)) {
+        log_drain();
+        SDL_Delay(LOG_DRAIN_MS);
+    }
+
+    log_drain();
+
+    return 0;
+}
+
+static void log_drain() {
+    SDL_LockMutex(log_sys.drain_lock);
+
+    int nrings = SDL_AtomicGet(&log_sys.nrings);
+    if (nrings > MAX_LOG_THREADS) {
+        nrings = MAX_LOG_THREADS;
+    }
+
+    /* Merge the rings so output stays in timestamp order across threads. */
+    for (;;) {
+        Log_Ring *oldest = NULL;
+        Log_Record *oldest_rec = NULL;
+        for (int i = 0; i < nrings; i++) {
+            Log_Ring *ring = &log_sys.rings[i];
+            int tail = SDL_AtomicGet(&ring->tail);
+            if (tail == SDL_AtomicGet(&ring->head)) {
+                continue;
+            }
+
+            Log_Record *rec = &ring->records[((unsigned) tail) & (LOG_RING_SIZE - 1)];
+            if (!oldest_rec || rec->time < oldest_rec->time) {
+                oldest = ring;
+                oldest_rec = rec;
+            }
+        }
+
+        if (!oldest) {
+            break;
+        }
+
+        record_print(oldest_rec);
+        SDL_AtomicAdd(&oldest->tail, 1);
+    }
+
+    for (int i = 0; i < nrings; i++) {
+        int dropped = SDL_AtomicSet(&log_sys.rings[i].dropped, 0);
+        if (dropped) {
+            printf("LOG: dropped %d records from thread %d\n", dropped, i);
+        }
+    }
+
+    fflush(stdout);
+
+    SDL_UnlockMutex(log_sys.drain_lock);
+}
+
+static Log_Ring *log_thread_ring() {
+    if (thread_ring_slot == 0) {
+        int slot = SDL_AtomicAdd(&log_sys.nrings, 1);
+        thread_ring_slot = slot < MAX_LOG_THREADS ? slot + 1 : -1;
+    }
+
+    /* Threads past the limit fall back to printing directly. */
+    return thread_ring_slot > 0 ? &log_sys.rings[thread_ring_slot - 1] : NULL;
+}
+
+/* `p` points just past the '%'. Returns a pointer to the conversion
+ * character, or to the terminating '\0' of a truncated spec. */
+static const char *spec_parse(const char *p, Log_Spec *spec) {
+    spec->length = LEN_NONE;
+    spec->star_width = false;
+    spec->star_prec = false;
+
+    while (*p && strchr("-+ #0", *p)) {
+        p++;
+    }
+
+    if (*p == '*') {
+        spec->star_width = true;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->star_prec = true;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    switch (*p) {
+        case 'h':
+            p++;
+            spec->length = LEN_H;
+            if (*p == 'h') {
+                spec->length = LEN_HH;
+                p++;
+            }
+            break;
+        case 'l':
+            p++;
+            spec->length = LEN_L;
+            if (*p == 'l') {
+                spec->length = LEN_LL;
+                p++;
+            }
+            break;
+        case 'z':
+            spec->length = LEN_Z;
+            p++;
+            break;
+        case 'j':
+            spec->length = LEN_J;
+            p++;
+            break;
+        case 't':
+            spec->length = LEN_T;
+            p++;
+            break;
+        case 'L':
+            spec->length = LEN_BIG_L;
+            p++;
+            break;
+    }
+
+    spec->conv = *p;
+    return p;
+}
+
+static void record_fill(Log_Record *rec, const char *fmt, va_list args) {
+    rec->nargs = 0;
+    rec->str_len = 0;
+
+    for (const char *p = fmt; *p && rec->nargs < LOG_MAX_ARGS; p++) {
+        if (*p != '%') {
+            continue;
+        }
+
+        Log_Spec spec;
+        p = spec_parse(p + 1, &spec);
+        if (!*p) {
+            break;
+        }
+
+        if (spec.star_width && rec->nargs < LOG_MAX_ARGS) {
+            rec->args[rec->nargs++] = (uint64_t) (int64_t) va_arg(args, int);
+        }
+        if (spec.star_prec && rec->nargs < LOG_MAX_ARGS) {
+            rec->args[rec->nargs++] = (uint64_t) (int64_t) va_arg(args, int);
+        }
+        if (rec->nargs == LOG_MAX_ARGS) {
+            break;
+        }
+
+        uint64_t value = 0;
+        switch (spec.conv) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+                switch (spec.length) {
+                    case LEN_L:
+                        value = (uint64_t) va_arg(args, long);
+                        break;
+                    case LEN_LL:
+                        value = (uint64_t) va_arg(args, long long);
+                        break;
+                    case LEN_Z:
+                        value = (uint64_t) va_arg(args, size_t);
+                        break;
+                    case LEN_J:
+                        value = (uint64_t) va_arg(args, intmax_t);
+                        break;
+                    case LEN_T:
+                        value = (uint64_t) va_arg(args, ptrdiff_t);
+                        break;
+                    default:
+                        value = (uint64_t) (int64_t) va_arg(args, int);
+                        break;
+                }
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A': {
+                double d = spec.length == LEN_BIG_L
+                    ? (double) va_arg(args, long double) : va_arg(args, double);
+                memcpy(&value, &d, sizeof(d));
+                break;
+            }
+            case 's': {
+                const char *str = va_arg(args, const char *);
+                if (!str) {
+                    str = "(null)";
+                }
+                size_t room = LOG_STR_BYTES - rec->str_len;
+                size_t len = strlen(str);
+                if (len >= room) {
+                    len = room ? room - 1 : 0;
+                }
+                value = rec->str_len;
+                if (room) {
+                    memcpy(rec->strs + rec->str_len, str, len);
+                    rec->strs[rec->str_len + len] = '\0';
+                    rec->str_len += len + 1;
+                } else {
+                    value = LOG_STR_BYTES;
+                }
+                break;
+            }
+            case 'p':
+                value = (uint64_t) (uintptr_t) va_arg(args, void *);
+                break;
+            default:
+                /* '%%' and anything we don't understand take no argument. */
+                continue;
+        }
+
+        rec->args[rec->nargs++] = value;
+    }
+}
+
+static void record_print(const Log_Record *rec) {
+    char msg[LOG_MSG_BYTES];
+    size_t len = 0;
+    int arg = 0;
+
+    for (const char *p = rec->fmt; *p && len < sizeof(msg) - 1; p++) {
+        if (*p != '%') {
+            msg[len++] = *p;
+            continue;
+        }
+
+        const char *start = p;
+        Log_Spec spec;
+        p = spec_parse(p + 1, &spec);
+        if (!*p) {
+            break;
+        }
+
+        if (spec.conv == '%') {
+            msg[len++] = '%';
+            continue;
+        }
+
+        if (!strchr("diuxXocfFeEgGaAsp", spec.conv)) {
+            for (const char *c = start; c <= p && len < sizeof(msg) - 1; c++) {
+                msg[len++] = *c;
+            }
+            continue;
+        }
+
+        int star[2];
+        int nstar = 0;
+        if (spec.star_width) {
+            star[nstar++] = arg < rec->nargs ? (int) (int64_t) rec->args[arg++] : 0;
+        }
+        if (spec.star_prec) {
+            star[nstar++] = arg < rec->nargs ? (int) (int64_t) rec->args[arg++] : 0;
+        }
+
+        char one[32];
+        size_t one_len = p - start + 1;
+        if (one_len >= sizeof(one) || arg >= rec->nargs) {
+            msg[len++] = '?';
+            continue;
+        }
+        memcpy(one, start, one_len);
+        one[one_len] = '\0';
+
+        int written = format_arg(msg + len, sizeof(msg) - len, one, &spec,
+            rec->args[arg++], star, nstar, rec);
+        if (written > 0) {
+            len += written;
+            if (len > sizeof(msg) - 1) {
+                len = sizeof(msg) - 1;
+            }
+        }
+    }
+    msg[len] = '\0';
+
+    double seconds = 0.0;
+    if (rec->time > log_sys.start_time) {
+        seconds = ((double) (rec->time - log_sys.start_time)) / SDL_GetPerformanceFrequency();
+    }
+
+    printf("LOG: %9.4f %-5s %s:%d: %s\n", seconds, level_names[rec->level],
+        rec->file, rec->line, msg);
+}
+
+#define FORMAT_ONE(_value) \
+    (nstar == 0 ? snprintf(out, cap, one, _value) \
+    : nstar == 1 ? snprintf(out, cap, one, star[0], _value) \
+    : snprintf(out, cap, one, star[0], star[1], _value))
+
+static int format_arg(char *out, size_t cap, const char *one,
+    const Log_Spec *spec, uint64_t value, const int *star, int nstar,
+    const Log_Record *rec) {
+
+    switch (spec->conv) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            switch (spec->length) {
+                case LEN_L:
+                    return FORMAT_ONE((long) value);
+                case LEN_LL:
+                    return FORMAT_ONE((long long) value);
+                case LEN_Z:
+                    return FORMAT_ONE((size_t) value);
+                case LEN_J:
+                    return FORMAT_ONE((intmax_t) value);
+                case LEN_T:
+                    return FORMAT_ONE((ptrdiff_t) value);
+                default:
+                    return FORMAT_ONE((int) (int64_t) value);
+            }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            double d;
+            memcpy(&d, &value, sizeof(d));
+            if (spec->length == LEN_BIG_L) {
+                return FORMAT_ONE((long double) d);
+            }
+            return FORMAT_ONE(d);
+        }
+        case 's':
+            return FORMAT_ONE(value < LOG_STR_BYTES ? rec->strs + value : "");
+        case 'p':
+            return FORMAT_ONE((void *) (uintptr_t) value);
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,303 @@
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LOUDNESS_SSE
+#endif
+
+#include <aleph/loudness.h>
+#include <aleph/workers.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define BLOCKS_PER_SECOND 10
+#define BLOCKS_PER_WINDOW 4
+#define RELATIVE_GATE_LU -10.0
+
+/* Blocks per build task. Each task runs its filters in from silence over
+ * the frames before its chunk, long enough for the 38 Hz high pass to have
+ * forgotten it started. */
+#define CHUNK_BLOCKS 64
+#define PREROLL_FRAMES 4096
+
+struct Loudness_Index {
+    float *power; /* K-weighted mean square per block, channels summed. */
+    float *peaks; /* Sample peak per block. */
+    size_t nblocks;
+    size_t block_frames;
+    size_t frames;
+};
+
+/* The two K-weighting stages as one four lane filter: left and right into
+ * the high shelf, then left and right into the high pass a frame behind. A
+ * step takes each lane's input from the file or the lane before, so both
+ * stages advance together. */
+typedef struct {
+    float b0[4], b1[4], b2[4], a1[4], a2[4];
+} K_Coeffs;
+
+typedef struct {
+    float s1[4], s2[4], y[4];
+} K_State;
+
+typedef struct {
+    const Audio_File *file;
+    Loudness_Index *index;
+    K_Coeffs coeffs;
+} Loudness_Build;
+
+static void build_task(void *ud, size_t chunk);
+static float k_weight(const Loudness_Build *build, K_State *state, size_t from, size_t to, float *peak);
+static void k_coeffs(K_Coeffs *coeffs, int sample_rate);
+static double window_power(const Loudness_Index *index, size_t first);
+static size_t block_len(const Loudness_Index *index, size_t block);
+static float power_to_lufs(double power);
+
+Loudness_Index *loudness_build(const Audio_File *file) {
+    Loudness_Index *index = NEW(Loudness_Index);
+    index->frames = file->len / file->nchannels;
+    index->block_frames = file->sample_rate / BLOCKS_PER_SECOND;
+    index->nblocks = (index->frames + index->block_frames - 1) / index->block_frames;
+    index->power = NEW_ARR(float, index->nblocks ? index->nblocks : 1);
+    index->peaks = NEW_ARR(float, index->nblocks ? index->nblocks : 1);
+
+    Loudness_Build build = {
+        .file = file,
+        .index = index,
+    };
+    k_coeffs(&build.coeffs, file->sample_rate);
+
+    size_t nchunks = (index->nblocks + CHUNK_BLOCKS - 1) / CHUNK_BLOCKS;
+    Worker_Pool *pool = workers_create(0, false);
+    workers_run(pool, nchunks, build_task, &build);
+    workers_free(pool);
+
+    if (index->frames > 0) {
+        Loudness whole = loudness_measure(index, 0, index->frames - 1);
+        LOG_FMT("integrated loudness %.1f LUFS, peak %.1f dBFS", whole.lufs,
+            whole.peak > 0.0f ? 20.0f * log10f(whole.peak) : -INFINITY);
+    }
+    return index;
+}
+
+void loudness_free(Loudness_Index *index) {
+    FREE(index->power);
+    FREE(index->peaks);
+    FREE(index);
+}
+
+/* Windows a block apart, gated first at LOUDNESS_GATE_LUFS and then at
+ * RELATIVE_GATE_LU under what passed. A stretch shorter than a window is
+ * one window of whatever it has. */
+Loudness loudness_measure(const Loudness_Index *index, size_t start, size_t end) {
+    Loudness out = {LOUDNESS_GATE_LUFS, 0.0f};
+    if (index->nblocks == 0 || start > end) {
+        return out;
+    }
+
+    size_t first = start / index->block_frames;
+    size_t last = end / index->block_frames;
+    if (last >= index->nblocks) {
+        last = index->nblocks - 1;
+    }
+
+    for (size_t b = first; b <= last; b++) {
+        if (index->peaks[b] > out.peak) {
+            out.peak = index->peaks[b];
+        }
+    }
+
+    size_t nblocks = last - first + 1;
+    if (nblocks < BLOCKS_PER_WINDOW) {
+        double sum = 0.0;
+        size_t frames = 0;
+        for (size_t b = first; b <= last; b++) {
+            sum += (double) index->power[b] * block_len(index, b);
+            frames += block_len(index, b);
+        }
+
+        float lufs = power_to_lufs(sum / frames);
+        out.lufs = lufs > LOUDNESS_GATE_LUFS ? lufs : LOUDNESS_GATE_LUFS;
+        return out;
+    }
+
+    size_t nwindows = nblocks - BLOCKS_PER_WINDOW + 1;
+    double abs_gate = pow(10.0, (LOUDNESS_GATE_LUFS + 0.691) / 10.0);
+    double sum = 0.0;
+    size_t count = 0;
+    for (size_t w = 0; w < nwindows; w++) {
+        double power = window_power(index, first + w);
+        if (power > abs_gate) {
+            sum += power;
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        return out;
+    }
+
+    double rel_gate = sum / count * pow(10.0, RELATIVE_GATE_LU / 10.0);
+    sum = 0.0;
+    count = 0;
+    for (size_t w = 0; w < nwindows; w++) {
+        double power = window_power(index, first + w);
+        if (power > abs_gate && power > rel_gate) {
+            sum += power;
+            count++;
+        }
+    }
+
+    out.lufs = power_to_lufs(sum / count);
+    return out;
+}
+
+static void build_task(void *ud, size_t chunk) {
+    Loudness_Build *build = (Loudness_Build *) ud;
+    Loudness_Index *index = build->index;
+
+    size_t first = chunk * CHUNK_BLOCKS;
+    size_t last = first + CHUNK_BLOCKS < index->nblocks ? first + CHUNK_BLOCKS : index->nblocks;
+    size_t start = first * index->block_frames;
+
+    K_State state = {0};
+    float unused;
+    k_weight(build, &state, start > PREROLL_FRAMES ? start - PREROLL_FRAMES : 0, start, &unused);
+
+    for (size_t b = first; b < last; b++) {
+        size_t from = b * index->block_frames;
+        size_t len = block_len(index, b);
+        float sumsq = k_weight(build, &state, from, from + len, &index->peaks[b]);
+        index->power[b] = sumsq / len;
+    }
+}
+
+/* Filters frames [from, to), returning the sum of squares out of the high
+ * pass over both channels, and their sample peak in `peak`. What comes out
+ * is a frame late, which no loudness reading can tell. A mono file goes
+ * through both sides at half the power. */
+static float k_weight(const Loudness_Build *build, K_State *state, size_t from, size_t to, float *peak) {
+    const K_Coeffs *k = &build->coeffs;
+    const float *data = build->file->data.f32;
+    int nchannels = build->file->nchannels;
+    float scale = nchannels == 1 ? 0.5f : 1.0f;
+
+#ifdef LOUDNESS_SSE
+    __m128 b0 = _mm_loadu_ps(k->b0), b1 = _mm_loadu_ps(k->b1), b2 = _mm_loadu_ps(k->b2);
+    __m128 a1 = _mm_loadu_ps(k->a1), a2 = _mm_loadu_ps(k->a2);
+    __m128 s1 = _mm_loadu_ps(state->s1), s2 = _mm_loadu_ps(state->s2);
+    __m128 y = _mm_loadu_ps(state->y);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vsum = _mm_setzero_ps();
+    __m128 vmax = _mm_setzero_ps();
+
+    for (size_t i = from; i < to; i++) {
+        const float *frame = &data[i * nchannels];
+        __m128 in = nchannels > 1 ? _mm_castpd_ps(_mm_load_sd((const double *) frame))
+            : _mm_set1_ps(frame[0]);
+        vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, in));
+
+        __m128 x = _mm_shuffle_ps(in, y, _MM_SHUFFLE(1, 0, 1, 0));
+        y = _mm_add_ps(_mm_mul_ps(b0, x), s1);
+        s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), s2);
+        s2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+        vsum = _mm_add_ps(vsum, _mm_mul_ps(y, y));
+    }
+
+    _mm_storeu_ps(state->s1, s1);
+    _mm_storeu_ps(state->s2, s2);
+    _mm_storeu_ps(state->y, y);
+
+    float sums[4], maxes[4];
+    _mm_storeu_ps(sums, vsum);
+    _mm_storeu_ps(maxes, vmax);
+    *peak = maxes[0] > maxes[1] ? maxes[0] : maxes[1];
+    return (sums[2] + sums[3]) * scale;
+#else
+    float sum[2] = {0.0f, 0.0f};
+    *peak = 0.0f;
+
+    for (size_t i = from; i < to; i++) {
+        const float *frame = &data[i * nchannels];
+        float x[4] = {frame[0], frame[nchannels > 1 ? 1 : 0], state->y[0], state->y[1]};
+        for (int c = 0; c < 2; c++) {
+            float mag = fabsf(x[c]);
+            if (mag > *peak) {
+                *peak = mag;
+            }
+        }
+
+        for (int l = 0; l < 4; l++) {
+            float out = k->b0[l] * x[l] + state->s1[l];
+            state->s1[l] = k->b1[l] * x[l] - k->a1[l] * out + state->s2[l];
+            state->s2[l] = k->b2[l] * x[l] - k->a2[l] * out;
+            state->y[l] = out;
+        }
+
+        sum[0] += state->y[2] * state->y[2];
+        sum[1] += state->y[3] * state->y[3];
+    }
+
+    return (sum[0] + sum[1]) * scale;
+#endif
+}
+
+/* BS.1770's shelf and high pass, designed for `sample_rate` from the
+ * analog prototypes its 48 kHz coefficients come from. */
+static void k_coeffs(K_Coeffs *coeffs, int sample_rate) {
+    double k = tan(M_PI * 1681.974450955533 / sample_rate);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    double shelf[5] = {
+        (vh + vb * k / q + k * k) / a0,
+        2.0 * (k * k - vh) / a0,
+        (vh - vb * k / q + k * k) / a0,
+        2.0 * (k * k - 1.0) / a0,
+        (1.0 - k / q + k * k) / a0,
+    };
+
+    k = tan(M_PI * 38.13547087602444 / sample_rate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+    double high_pass[5] = {
+        1.0,
+        -2.0,
+        1.0,
+        2.0 * (k * k - 1.0) / a0,
+        (1.0 - k / q + k * k) / a0,
+    };
+
+    for (int l = 0; l < 4; l++) {
+        const double *c = l < 2 ? shelf : high_pass;
+        coeffs->b0[l] = (float) c[0];
+        coeffs->b1[l] = (float) c[1];
+        coeffs->b2[l] = (float) c[2];
+        coeffs->a1[l] = (float) c[3];
+        coeffs->a2[l] = (float) c[4];
+    }
+}
+
+static double window_power(const Loudness_Index *index, size_t first) {
+    double sum = 0.0;
+    size_t frames = 0;
+    for (size_t b = first; b < first + BLOCKS_PER_WINDOW; b++) {
+        sum += (double) index->power[b] * block_len(index, b);
+        frames += block_len(index, b);
+    }
+
+    return sum / frames;
+}
+
+/* Every block is whole but maybe the file's last. */
+static size_t block_len(const Loudness_Index *index, size_t block) {
+    size_t from = block * index->block_frames;
+    return from + index->block_frames < index->frames ? index->block_frames : index->frames - from;
+}
+
+static float power_to_lufs(double power) {
+    return power > 0.0 ? (float) (-0.691 + 10.0 * log10(power)) : LOUDNESS_GATE_LUFS;
+}
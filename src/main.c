@@ -1,18 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL.h>
+
 #include <aleph/defs.h>
+#include <aleph/log.h>
 #include <aleph/audio.h>
 #include <aleph/gui.h>
+#include <aleph/osc.h>
+#include <aleph/stress.h>
+
+#define EXPORT_PATH_LEN 1024
+
+/* Chop points move to the quietest zero crossing this close. */
+#define CHOP_SNAP_SECONDS 0.01
 
-int main() {
+static int audio_load_thread(void *ud);
+static void export_chops(const char *dir, double seconds, int send);
+static void usage();
+
+int main(int argc, char **argv) {
+    Audio_Config config = {0};
+    config.reverb_mix = 0.3f;
+    bool headless = false;
+    bool stress = false;
+    const char *export_dir = NULL;
+    double chop_seconds = 1.0;
+    double seconds = 0.0;
+    int osc_port = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--backend") == 0 && i + 1 < argc) {
+            config.backend = argv[++i];
+        } else if (strcmp(arg, "--out") == 0 && i + 1 < argc) {
+            config.out_path = argv[++i];
+        } else if (strcmp(arg, "--fast") == 0) {
+            config.fast = true;
+        } else if (strcmp(arg, "--reverb") == 0 && i + 1 < argc) {
+            config.reverb = argv[++i];
+        } else if (strcmp(arg, "--reverb-mix") == 0 && i + 1 < argc) {
+            config.reverb_mix = atof(argv[++i]);
+        } else if (strcmp(arg, "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(arg, "--export") == 0 && i + 1 < argc) {
+            export_dir = argv[++i];
+        } else if (strcmp(arg, "--chop") == 0 && i + 1 < argc) {
+            chop_seconds = atof(argv[++i]);
+        } else if (strcmp(arg, "--stress") == 0) {
+            stress = true;
+        } else if (strcmp(arg, "--osc") == 0 && i + 1 < argc) {
+            osc_port = atoi(argv[++i]);
+        } else if (strcmp(arg, "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (arg[0] == '-') {
+            usage();
+            return EXIT_FAILURE;
+        } else {
+            config.path = arg;
+        }
+    }
+
+    log_init();
     LOG("aleph v0.1");
 
-    audio_init();
-    gui_init();
+    if (headless && !export_dir && !stress) {
+        config.seconds = seconds;
+    }
+
+    /* The window and GL context come up while the file decodes; neither
+     * needs the other until the first frame. */
+    bool windowed = !export_dir && !stress && !headless;
+    if (windowed) {
+        SDL_Thread *load = SDL_CreateThread(audio_load_thread, "audio load", &config);
+        gui_init();
+        SDL_WaitThread(load, NULL);
+        audio_start(&config);
+        gui_start();
+    } else {
+        audio_init(&config);
+    }
 
-    while (gui_is_running()) {
-        gui_update();
-        gui_draw();
+    if (osc_port > 0 && !osc_start(osc_port)) {
+        if (windowed) {
+            gui_free();
+        }
+        audio_stop();
+        log_shutdown();
+        return EXIT_FAILURE;
     }
 
+    if (export_dir) {
+        export_chops(export_dir, chop_seconds, config.reverb ? 0 : -1);
+    } else if (stress) {
+        stress_run(seconds);
+    } else if (headless) {
+        /* Without a GUI, run until the backend has produced enough audio.
+         * With --fast that takes as long as rendering it does. */
+        audio_wait();
+    } else {
+        while (gui_is_running()) {
+            gui_update();
+            gui_draw();
+        }
+
+        gui_free();
+    }
+
+    osc_stop();
     audio_stop();
+    log_shutdown();
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+static int audio_load_thread(void *ud) {
+    audio_load(ud);
+    return 0;
+}
+
+/* Cuts the whole file into back to back slices and exports them all. */
+static void export_chops(const char *dir, double seconds, int send) {
+    const Audio_File *file = audio_get_file();
+    size_t frames = file->len / file->nchannels;
+    size_t chop = (size_t) (seconds * file->sample_rate);
+    if (chop == 0) {
+        FAIL("--chop must be positive");
+    }
+
+    size_t count = (frames + chop - 1) / chop;
+    Audio_Export *exports = NEW_ARR(Audio_Export, count);
+    char *paths = NEW_ARR(char, count * EXPORT_PATH_LEN);
+
+    const Snap_Index *snap = audio_get_snap();
+    size_t radius = (size_t) (CHOP_SNAP_SECONDS * file->sample_rate);
+    size_t start = 0;
+    for (size_t i = 0; i < count; i++) {
+        char *path = &paths[i * EXPORT_PATH_LEN];
+        snprintf(path, EXPORT_PATH_LEN, "%s/chop_%04d.wav", dir, (int) i);
+
+        size_t next = frames;
+        if ((i + 1) * chop < frames) {
+            next = snap_quiet(snap, (i + 1) * chop, radius);
+            if (next <= start) {
+                next = (i + 1) * chop;
+            }
+        }
+
+        exports[i].start = start;
+        exports[i].end = next - 1;
+        exports[i].send = send;
+        exports[i].path = path;
+        start = next;
+    }
+
+    audio_export(exports, count);
+
+    FREE(paths);
+    FREE(exports);
+}
+
+static void usage() {
+    printf("usage: aleph [options] [file.wav|file.flac]\n"
+        "  --backend NAME   portaudio (default), null or file\n"
+        "  --out PATH       output of the file backend (default out.wav)\n"
+        "  --fast           null/file backends render as fast as possible\n"
+        "  --reverb PATH    convolve slices with an impulse response\n"
+        "  --reverb-mix N   wet amount of the reverb, 0-1 (default 0.3)\n"
+        "  --headless       run without a window\n"
+        "  --export DIR     cut the file into slices, render each to DIR, then exit\n"
+        "  --chop N         with --export, seconds per slice (default 1)\n"
+        "  --osc PORT       take slice and channel commands over OSC on localhost\n"
+        "  --stress         find how many voices the mixer sustains, then exit\n"
+        "  --seconds N      with --headless, stop after N seconds of audio;\n"
+        "                   with --stress, how long each stage runs (default 2)\n");
+}
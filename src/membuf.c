@@ -2,7 +2,25 @@
 
 #include <aleph/membuf.h>
 
+static bool membuf_read(Membuf *buf, Arena *arena, const char *path);
+
 bool membuf_load(Membuf *buf, const char *path) {
+    return membuf_read(buf, NULL, path);
+}
+
+bool membuf_load_arena(Membuf *buf, Arena *arena, const char *path) {
+    return membuf_read(buf, arena, path);
+}
+
+void membuf_free(Membuf *buf) {
+    if (buf) {
+        FREE(buf->data);
+        buf->data = NULL;
+        buf->len = 0;
+    }
+}
+
+static bool membuf_read(Membuf *buf, Arena *arena, const char *path) {
     FILE *f = fopen(path, "rb");
     if (f == NULL) {
         buf->data = NULL;
@@ -13,7 +31,7 @@ bool membuf_load(Membuf *buf, const char *path) {
     fseek(f, 0, SEEK_END);
     size_t len = ftell(f);
     fseek(f, 0, SEEK_SET);
-    uint8_t *data = NEW_ARR(uint8_t, len + 1);
+    uint8_t *data = arena ? ARENA_NEW_ARR(arena, uint8_t, len + 1) : NEW_ARR(uint8_t, len + 1);
     fread(data, 1, len, f);
     fclose(f);
     data[len] = '\0';
@@ -22,12 +40,4 @@ bool membuf_load(Membuf *buf, const char *path) {
     buf->len = len;
 
     return true ;
-}
-
-void membuf_free(Membuf *buf) {
-    if (buf) {
-        FREE(buf->data);
-        buf->data = NULL;
-        buf->len = 0;
-    }
-}
\ No newline at end of file
+}
\ No newline at end of file
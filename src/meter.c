@@ -0,0 +1,200 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define METER_SSE
+#endif
+
+#include <aleph/meter.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define RMS_SECONDS 0.3
+#define PEAK_FALL_DB_PER_SECOND 20.0
+
+/* Between samples a band limited signal can only overshoot its sample peak
+ * by a few dB, so below this the sample peak stands in for the true peak
+ * and the oversampler doesn't run. */
+#define TRUE_PEAK_FLOOR 0.5f
+
+#define CHUNK_FRAMES 64
+
+static struct {
+    float rms_alpha;
+    float decay;
+    /* Phases 1-3 of the oversampler; phase 0 is the samples themselves. */
+    float fir[3][METER_TAPS];
+} meter_sys;
+
+static void meter_true_peak(Meter *meter, const float *data, size_t frames, float *tp);
+static void meter_keep_history(Meter *meter, const float *data, size_t frames);
+
+void meter_setup(int sample_rate, size_t block_frames) {
+    double block_seconds = ((double) block_frames) / sample_rate;
+    meter_sys.rms_alpha = 1.0 - exp(-block_seconds / RMS_SECONDS);
+    meter_sys.decay = pow(10.0, -PEAK_FALL_DB_PER_SECOND * block_seconds / 20.0);
+
+    /* Hann windowed sinc, each phase normalized to unity gain at DC. Tap t
+     * weights x[n - t] for a point between x[n - TAPS/2] and the next. */
+    double half = METER_TAPS / 2;
+    for (int phase = 1; phase < 4; phase++) {
+        double frac = phase / 4.0;
+        double sum = 0.0;
+        double taps[METER_TAPS];
+        for (int t = 0; t < METER_TAPS; t++) {
+            double x = half - t - frac;
+            double sinc = sin(M_PI * x) / (M_PI * x);
+            double window = 0.5 + 0.5 * cos(M_PI * x / half);
+            taps[t] = sinc * window;
+            sum += taps[t];
+        }
+
+        for (int t = 0; t < METER_TAPS; t++) {
+            meter_sys.fir[phase - 1][t] = taps[t] / sum;
+        }
+    }
+}
+
+void meter_process(Meter *meter, const float *data, size_t frames, Meter_Level *out) {
+    float peak[2], sumsq[2];
+    size_t len = frames * 2;
+    size_t i = 0;
+
+#ifdef METER_SSE
+    /* Lanes alternate left and right, so each half of the vector is one
+     * frame and the two halves fold together at the end. */
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vmax = _mm_setzero_ps();
+    __m128 vsum = _mm_setzero_ps();
+    for (; i + 4 <= len; i += 4) {
+        __m128 x = _mm_loadu_ps(&data[i]);
+        vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, x));
+        vsum = _mm_add_ps(vsum, _mm_mul_ps(x, x));
+    }
+    vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+    vsum = _mm_add_ps(vsum, _mm_movehl_ps(vsum, vsum));
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, vmax);
+    peak[0] = lanes[0];
+    peak[1] = lanes[1];
+    _mm_storeu_ps(lanes, vsum);
+    sumsq[0] = lanes[0];
+    sumsq[1] = lanes[1];
+#else
+    peak[0] = peak[1] = 0.0f;
+    sumsq[0] = sumsq[1] = 0.0f;
+#endif
+
+    for (; i < len; i++) {
+        float x = data[i];
+        float mag = fabsf(x);
+        if (mag > peak[i & 1]) {
+            peak[i & 1] = mag;
+        }
+        sumsq[i & 1] += x * x;
+    }
+
+    float tp[2] = {peak[0], peak[1]};
+    if (peak[0] > TRUE_PEAK_FLOOR || peak[1] > TRUE_PEAK_FLOOR) {
+        meter_true_peak(meter, data, frames, tp);
+    } else {
+        meter_keep_history(meter, data, frames);
+    }
+
+    if (peak[0] > 1.0f || peak[1] > 1.0f) {
+        meter->clips++;
+    }
+
+    for (int c = 0; c < 2; c++) {
+        float ms = frames ? sumsq[c] / frames : 0.0f;
+        meter->ms[c] += meter_sys.rms_alpha * (ms - meter->ms[c]);
+
+        float peak_fall = meter->peak[c] * meter_sys.decay;
+        meter->peak[c] = peak[c] > peak_fall ? peak[c] : peak_fall;
+
+        float tp_fall = meter->true_peak[c] * meter_sys.decay;
+        meter->true_peak[c] = tp[c] > tp_fall ? tp[c] : tp_fall;
+
+        out->peak[c] = meter->peak[c];
+        out->rms[c] = sqrtf(meter->ms[c]);
+        out->true_peak[c] = meter->true_peak[c];
+    }
+    out->clips = meter->clips;
+}
+
+/* 4x oversampled peak: three interpolated points between every pair of
+ * samples, two frames of both channels per vector. Leaves the history
+ * updated. */
+static void meter_true_peak(Meter *meter, const float *data, size_t frames, float *tp) {
+    const size_t hist_len = (METER_TAPS - 1) * 2;
+    float buf[(METER_TAPS - 1 + CHUNK_FRAMES) * 2];
+    memcpy(buf, meter->hist, hist_len * sizeof(float));
+
+    while (frames > 0) {
+        size_t n = frames < CHUNK_FRAMES ? frames : CHUNK_FRAMES;
+        memcpy(&buf[hist_len], data, n * 2 * sizeof(float));
+
+        size_t frame = 0;
+#ifdef METER_SSE
+        __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 vmax = _mm_setzero_ps();
+        for (; frame + 2 <= n; frame += 2) {
+            const float *x = &buf[(frame + METER_TAPS - 1) * 2];
+            for (int phase = 0; phase < 3; phase++) {
+                const float *fir = meter_sys.fir[phase];
+                __m128 acc = _mm_setzero_ps();
+                for (int t = 0; t < METER_TAPS; t++) {
+                    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(fir[t]), _mm_loadu_ps(x - t * 2)));
+                }
+                vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, acc));
+            }
+        }
+        vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, vmax);
+        for (int c = 0; c < 2; c++) {
+            if (lanes[c] > tp[c]) {
+                tp[c] = lanes[c];
+            }
+        }
+#endif
+
+        for (; frame < n; frame++) {
+            const float *x = &buf[(frame + METER_TAPS - 1) * 2];
+            for (int phase = 0; phase < 3; phase++) {
+                const float *fir = meter_sys.fir[phase];
+                for (int c = 0; c < 2; c++) {
+                    float acc = 0.0f;
+                    for (int t = 0; t < METER_TAPS; t++) {
+                        acc += fir[t] * x[c - t * 2];
+                    }
+                    if (fabsf(acc) > tp[c]) {
+                        tp[c] = fabsf(acc);
+                    }
+                }
+            }
+        }
+
+        memmove(buf, &buf[n * 2], hist_len * sizeof(float));
+        data += n * 2;
+        frames -= n;
+    }
+
+    memcpy(meter->hist, buf, hist_len * sizeof(float));
+}
+
+static void meter_keep_history(Meter *meter, const float *data, size_t frames) {
+    const size_t hist_frames = METER_TAPS - 1;
+    if (frames >= hist_frames) {
+        memcpy(meter->hist, &data[(frames - hist_frames) * 2], hist_frames * 2 * sizeof(float));
+    } else {
+        size_t keep = hist_frames - frames;
+        memmove(meter->hist, &meter->hist[frames * 2], keep * 2 * sizeof(float));
+        memcpy(&meter->hist[keep * 2], data, frames * 2 * sizeof(float));
+    }
+}
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <SDL.h>
+
+#include <aleph/audio.h>
+#include <aleph/osc.h>
+
+#if defined(_WIN32)
+typedef SOCKET Socket;
+#define BAD_SOCKET INVALID_SOCKET
+#define close_socket closesocket
+#else
+typedef int Socket;
+#define BAD_SOCKET -1
+#define close_socket close
+#endif
+
+#define MAX_PACKET 65536
+#define MAX_ARGS 8
+#define MAX_REPLY 64
+
+/* How often the thread looks up from the socket to see if it should stop. */
+#define POLL_MS 100
+
+/* OSC time tags are NTP: seconds since 1900 in the high half. */
+#define NTP_UNIX_OFFSET 2208988800ull
+#define TAG_IMMEDIATELY 1
+
+typedef struct {
+    char type;
+    int64_t i;
+    float f;
+} Osc_Arg;
+
+typedef struct {
+    const uint8_t *p, *end;
+} Osc_Reader;
+
+static struct {
+    Socket sock;
+    SDL_Thread *thread;
+    SDL_atomic_t stop;
+    uint8_t packet[MAX_PACKET];
+} osc_sys;
+
+static int osc_thread(void *ud);
+static void handle_packet(const uint8_t *data, size_t len, uint64_t frame,
+    const struct sockaddr_in *from, int depth);
+static void handle_message(const uint8_t *data, size_t len, uint64_t frame,
+    const struct sockaddr_in *from);
+static void dispatch(const char *address, const Osc_Arg *args, int nargs, uint64_t frame,
+    const struct sockaddr_in *from);
+static void reply_int(const struct sockaddr_in *to, const char *address, int32_t value);
+static bool read_string(Osc_Reader *reader, const char **out);
+static bool read_u32(Osc_Reader *reader, uint32_t *out);
+static bool read_u64(Osc_Reader *reader, uint64_t *out);
+static bool float_to_int(double value, int64_t *out);
+static uint64_t tag_to_frame(uint64_t tag);
+static uint64_t ntp_now();
+
+bool osc_start(int port) {
+#if defined(_WIN32)
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        LOG_ERROR("winsock failed to start");
+        return false;
+    }
+#endif
+
+    osc_sys.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (osc_sys.sock == BAD_SOCKET) {
+        LOG_ERROR("cannot open an OSC socket");
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t) port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(osc_sys.sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        LOG_ERROR_FMT("cannot listen for OSC on port %d", port);
+        close_socket(osc_sys.sock);
+        return false;
+    }
+
+#if defined(_WIN32)
+    DWORD timeout = POLL_MS;
+#else
+    struct timeval timeout = {0, POLL_MS * 1000};
+#endif
+    setsockopt(osc_sys.sock, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout));
+
+    SDL_AtomicSet(&osc_sys.stop, 0);
+    osc_sys.thread = SDL_CreateThread(osc_thread, "osc", NULL);
+
+    LOG_FMT("listening for OSC on port %d", port);
+    return true;
+}
+
+void osc_stop() {
+    if (!osc_sys.thread) {
+        return;
+    }
+
+    SDL_AtomicSet(&osc_sys.stop, 1);
+    SDL_WaitThread(osc_sys.thread, NULL);
+    osc_sys.thread = NULL;
+    close_socket(osc_sys.sock);
+
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
+
+static int osc_thread(void *ud) {
+    IGNORE(ud);
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    while (!SDL_AtomicGet(&osc_sys.stop)) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(osc_sys.sock, (char *) osc_sys.packet, MAX_PACKET, 0,
+            (struct sockaddr *) &from, &from_len);
+        if (len > 0) {
+            handle_packet(osc_sys.packet, len, 0, &from, 0);
+        }
+    }
+
+    return 0;
+}
+
+/* A message, or a bundle of messages and bundles. Elements of a bundle are
+ * never due before the bundle holding them. */
+static void handle_packet(const uint8_t *data, size_t len, uint64_t frame,
+    const struct sockaddr_in *from, int depth) {
+    if (len >= 1 && data[0] == '/') {
+        handle_message(data, len, frame, from);
+        return;
+    }
+
+    if (len < 16 || memcmp(data, "#bundle", 8) != 0 || depth > 8) {
+        return;
+    }
+
+    Osc_Reader reader = {data + 8, data + len};
+    uint64_t tag;
+    read_u64(&reader, &tag);
+
+    uint64_t tagged = tag_to_frame(tag);
+    if (tagged > frame) {
+        frame = tagged;
+    }
+
+    uint32_t size;
+    while (read_u32(&reader, &size)) {
+        if (size > (size_t) (reader.end - reader.p)) {
+            break;
+        }
+        handle_packet(reader.p, size, frame, from, depth + 1);
+        reader.p += size;
+    }
+}
+
+static void handle_message(const uint8_t *data, size_t len, uint64_t frame,
+    const struct sockaddr_in *from) {
+    Osc_Reader reader = {data, data + len};
+
+    const char *address, *types;
+    if (!read_string(&reader, &address) || !read_string(&reader, &types) || types[0] != ',') {
+        return;
+    }
+
+    Osc_Arg args[MAX_ARGS];
+    int nargs = 0;
+    for (const char *t = types + 1; *t && nargs < MAX_ARGS; t++) {
+        Osc_Arg *arg = &args[nargs];
+        arg->type = *t;
+
+        uint32_t u32;
+        uint64_t u64;
+        switch (*t) {
+            case 'i':
+                if (!read_u32(&reader, &u32)) {
+                    return;
+                }
+                arg->i = (int32_t) u32;
+                arg->f = (float) arg->i;
+                break;
+            case 'h':
+                if (!read_u64(&reader, &u64)) {
+                    return;
+                }
+                arg->i = (int64_t) u64;
+                arg->f = (float) arg->i;
+                break;
+            case 'f':
+                if (!read_u32(&reader, &u32)) {
+                    return;
+                }
+                memcpy(&arg->f, &u32, sizeof(float));
+                if (!float_to_int(arg->f, &arg->i)) {
+                    LOG_WARN_FMT("OSC float in %s out of range", address);
+                    return;
+                }
+                break;
+            case 'd': {
+                if (!read_u64(&reader, &u64)) {
+                    return;
+                }
+                double d;
+                memcpy(&d, &u64, sizeof(double));
+                if (!float_to_int(d, &arg->i)) {
+                    LOG_WARN_FMT("OSC double in %s out of range", address);
+                    return;
+                }
+                arg->f = (float) d;
+                break;
+            }
+            case 'T':
+            case 'F':
+                arg->i = *t == 'T';
+                arg->f = (float) arg->i;
+                break;
+            default:
+                /* Strings too: nothing takes one, and skipping them would
+                 * shift the arguments after into the wrong places. */
+                LOG_WARN_FMT("OSC type '%c' in %s not understood", *t, address);
+                return;
+        }
+        nargs++;
+    }
+
+    dispatch(address, args, nargs, frame, from);
+}
+
+static void dispatch(const char *address, const Osc_Arg *args, int nargs, uint64_t frame,
+    const struct sockaddr_in *from) {
+    const char *slice_prefix = "/aleph/slice/";
+    const char *chan_prefix = "/aleph/channel/";
+
+    if (strncmp(address, slice_prefix, strlen(slice_prefix)) == 0) {
+        const char *verb = address + strlen(slice_prefix);
+
+        if (strcmp(verb, "begin") == 0 && nargs >= 2) {
+            const Audio_File *file = audio_get_file();
+            int64_t frames = file->len / file->nchannels;
+            if (args[0].i < 0 || args[1].i < args[0].i || args[1].i >= frames) {
+                LOG_WARN("OSC slice out of the file");
+                return;
+            }
+
+            Slice_Id id = audio_slice_try_begin(args[0].i, args[1].i, nargs >= 3 && args[2].i);
+            if (id < 0) {
+                LOG_WARN("OSC slice dropped: no slices left");
+                return;
+            }
+            reply_int(from, "/aleph/slice/begun", id);
+            return;
+        }
+
+        if (nargs < 1 || args[0].i < 0 || args[0].i >= AUDIO_MAX_SLICES
+            || !audio_slice_live((Slice_Id) args[0].i)) {
+            LOG_WARN_FMT("OSC %s for no slice", address);
+            return;
+        }
+        Slice_Id id = (Slice_Id) args[0].i;
+
+        if (strcmp(verb, "end") == 0) {
+            audio_slice_end_at(id, frame);
+        } else if (strcmp(verb, "play") == 0) {
+            audio_slice_play_at(id, frame);
+        } else if (strcmp(verb, "stop") == 0) {
+            audio_slice_stop_at(id, frame);
+        } else if (strcmp(verb, "index") == 0 && nargs >= 2 && args[1].i >= 0) {
+            audio_slice_set_index_at(id, args[1].i, frame);
+        } else if (strcmp(verb, "sustain") == 0 && nargs >= 2) {
+            audio_slice_set_sustain_at(id, args[1].f, frame);
+        } else if (strcmp(verb, "stretch") == 0 && nargs >= 3
+            && args[1].i >= STRETCH_OFF && args[1].i <= STRETCH_VOCODER) {
+            audio_slice_set_stretch_at(id, (Stretch_Mode) args[1].i, args[2].f, frame);
+        } else if (strcmp(verb, "gain") == 0 && nargs >= 2 && args[1].f >= 0.0f) {
+            audio_slice_set_gain_at(id, args[1].f, frame);
+        } else if (strcmp(verb, "normalize") == 0 && nargs >= 2) {
+            audio_slice_normalize_at(id, args[1].f, frame);
+        } else if (strcmp(verb, "send") == 0 && nargs >= 2 && args[1].i < AUDIO_NUM_SENDS) {
+            audio_slice_set_send_at(id, args[1].i < 0 ? -1 : args[1].i, frame);
+        } else {
+            LOG_WARN_FMT("OSC %s not understood", address);
+        }
+        return;
+    }
+
+    if (strncmp(address, chan_prefix, strlen(chan_prefix)) == 0 && nargs >= 2) {
+        const char *name = address + strlen(chan_prefix);
+        if (args[0].i < 0 || args[0].i >= AUDIO_NUM_CHANNELS) {
+            LOG_WARN_FMT("OSC %s for no channel", address);
+            return;
+        }
+
+        Audio_Param param;
+        if (strcmp(name, "volume") == 0) {
+            param = AUDIO_PARAM_VOLUME;
+        } else if (strcmp(name, "delay_time") == 0) {
+            param = AUDIO_PARAM_DELAY_TIME;
+        } else if (strcmp(name, "delay_feedback") == 0) {
+            param = AUDIO_PARAM_DELAY_FEEDBACK;
+        } else {
+            LOG_WARN_FMT("OSC %s not understood", address);
+            return;
+        }
+
+        audio_channel_set_at((int) args[0].i, param, args[1].f, frame);
+        return;
+    }
+
+    LOG_WARN_FMT("OSC %s not understood", address);
+}
+
+static void reply_int(const struct sockaddr_in *to, const char *address, int32_t value) {
+    uint8_t buf[MAX_REPLY];
+    memset(buf, 0, sizeof(buf));
+
+    size_t len = strlen(address);
+    if (len + 1 + 8 > sizeof(buf)) {
+        return;
+    }
+
+    memcpy(buf, address, len);
+    size_t pos = (len + 4) & ~(size_t) 3;
+    memcpy(&buf[pos], ",i", 2);
+    pos += 4;
+
+    uint32_t be = htonl((uint32_t) value);
+    memcpy(&buf[pos], &be, 4);
+    pos += 4;
+
+    sendto(osc_sys.sock, (const char *) buf, (int) pos, 0, (const struct sockaddr *) to, sizeof(*to));
+}
+
+/* Strings are NUL terminated and padded to four bytes. */
+static bool read_string(Osc_Reader *reader, const char **out) {
+    const uint8_t *nul = memchr(reader->p, 0, reader->end - reader->p);
+    if (!nul) {
+        return false;
+    }
+
+    *out = (const char *) reader->p;
+    size_t len = (nul - reader->p + 4) & ~(size_t) 3;
+    reader->p = len <= (size_t) (reader->end - reader->p) ? reader->p + len : reader->end;
+    return true;
+}
+
+static bool read_u32(Osc_Reader *reader, uint32_t *out) {
+    if (reader->end - reader->p < 4) {
+        return false;
+    }
+
+    uint32_t be;
+    memcpy(&be, reader->p, 4);
+    *out = ntohl(be);
+    reader->p += 4;
+    return true;
+}
+
+static bool read_u64(Osc_Reader *reader, uint64_t *out) {
+    uint32_t hi, lo;
+    if (!read_u32(reader, &hi) || !read_u32(reader, &lo)) {
+        return false;
+    }
+
+    *out = ((uint64_t) hi << 32) | lo;
+    return true;
+}
+
+/* Converting a float outside the integer's range is undefined; NaN fails
+ * both comparisons. */
+static bool float_to_int(double value, int64_t *out) {
+    if (!(value >= -0x1p63 && value < 0x1p63)) {
+        return false;
+    }
+
+    *out = (int64_t) value;
+    return true;
+}
+
+/* Maps a time tag onto the mixer's clock from how far ahead of the wall
+ * clock it is; anything due already plays as soon as it can. */
+static uint64_t tag_to_frame(uint64_t tag) {
+    if (tag == TAG_IMMEDIATELY) {
+        return 0;
+    }
+
+    uint64_t now = ntp_now();
+    if (tag <= now) {
+        return 0;
+    }
+
+    double ahead = (tag - now) / 4294967296.0;
+    return audio_get_frames() + (uint64_t) (ahead * AUDIO_SAMPLE_RATE);
+}
+
+static uint64_t ntp_now() {
+#if defined(_WIN32)
+    /* 100ns ticks since 1601. */
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t ticks = ((uint64_t) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    uint64_t secs = ticks / 10000000 - 11644473600ull;
+    uint64_t frac = ticks % 10000000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t secs = tv.tv_sec;
+    uint64_t frac = tv.tv_usec * 10;
+#endif
+    return ((secs + NTP_UNIX_OFFSET) << 32) + (frac << 32) / 10000000;
+}
@@ -0,0 +1,159 @@
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define PARAM_SSE
+#endif
+
+#include <aleph/param.h>
+
+static void param_glide(Param *param, float *buf, size_t frames);
+static void fill_line(float *out, float start, float slope, size_t n);
+static int point_compare(const void *a, const void *b);
+
+void param_init(Param *param, float value, uint32_t smooth_frames) {
+    param->value = value;
+    param->target = value;
+    param->step = 0.0f;
+    param->ramp_left = 0;
+    param->smooth_frames = smooth_frames;
+    param->lane = NULL;
+}
+
+void param_set(Param *param, float target) {
+    param->target = target;
+    if (param->smooth_frames == 0 || target == param->value) {
+        param->value = target;
+        param->ramp_left = 0;
+        return;
+    }
+
+    param->step = (target - param->value) / param->smooth_frames;
+    param->ramp_left = param->smooth_frames;
+}
+
+Param_Lane *param_automate(Param *param, Param_Lane *lane) {
+    Param_Lane *old = param->lane;
+    if (lane) {
+        lane->cursor = 0;
+    }
+    param->lane = lane;
+    return old;
+}
+
+const float *param_block(Param *param, uint64_t time, size_t frames, float *buf, Param_Lane **done) {
+    *done = NULL;
+
+    Param_Lane *lane = param->lane;
+    uint64_t end = time + frames;
+    if (!lane || lane->points[0].frame >= end) {
+        if (param->ramp_left == 0) {
+            return NULL;
+        }
+
+        param_glide(param, buf, frames);
+        return buf;
+    }
+
+    /* Up to the lane's first point the param does what it did before. */
+    const Param_Point *points = lane->points;
+    size_t i = 0;
+    if (points[0].frame > time) {
+        i = points[0].frame - time;
+        param_glide(param, buf, i);
+    }
+
+    while (i < frames) {
+        uint64_t now = time + i;
+        while (lane->cursor < lane->count && points[lane->cursor].frame <= now) {
+            lane->cursor++;
+        }
+
+        if (lane->cursor == lane->count) {
+            float last = points[lane->count - 1].value;
+            fill_line(&buf[i], last, 0.0f, frames - i);
+            param->lane = NULL;
+            *done = lane;
+            break;
+        }
+
+        /* Split the block where the next point lands, so it takes effect
+         * on its own frame. */
+        const Param_Point *a = &points[lane->cursor - 1];
+        const Param_Point *b = &points[lane->cursor];
+        double slope = ((double) b->value - a->value) / (double) (b->frame - a->frame);
+        double start = a->value + slope * (double) (now - a->frame);
+
+        size_t n = frames - i;
+        if (b->frame - now < n) {
+            n = b->frame - now;
+        }
+
+        fill_line(&buf[i], start, slope, n);
+        i += n;
+    }
+
+    param->value = param->target = buf[frames - 1];
+    param->ramp_left = 0;
+    return buf;
+}
+
+Param_Lane *param_lane_create(const Param_Point *points, size_t count) {
+    if (count == 0) {
+        return NULL;
+    }
+
+    Param_Lane *lane = (Param_Lane *) NEW_ARR(uint8_t, sizeof(Param_Lane) + count * sizeof(Param_Point));
+    lane->count = count;
+    lane->cursor = 0;
+    memcpy(lane->points, points, count * sizeof(Param_Point));
+    qsort(lane->points, count, sizeof(Param_Point), point_compare);
+
+    return lane;
+}
+
+void param_lane_free(Param_Lane *lane) {
+    FREE(lane);
+}
+
+/* Writes the next `frames` values of the glide, or the resting value once
+ * it has arrived, and moves the param along. */
+static void param_glide(Param *param, float *buf, size_t frames) {
+    size_t n = param->ramp_left < frames ? param->ramp_left : frames;
+    if (n > 0) {
+        fill_line(buf, param->value + param->step, param->step, n);
+        param->ramp_left -= n;
+        param->value = param->ramp_left ? buf[n - 1] : param->target;
+    }
+
+    if (n < frames) {
+        fill_line(&buf[n], param->value, 0.0f, frames - n);
+    }
+}
+
+/* out[k] = start + slope * k. Each value is computed from its index rather
+ * than accumulated, so long lines don't drift. */
+static void fill_line(float *out, float start, float slope, size_t n) {
+    size_t i = 0;
+
+#ifdef PARAM_SSE
+    __m128 vstart = _mm_set1_ps(start);
+    __m128 vslope = _mm_set1_ps(slope);
+    __m128 index = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    __m128 four = _mm_set1_ps(4.0f);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(&out[i], _mm_add_ps(vstart, _mm_mul_ps(vslope, index)));
+        index = _mm_add_ps(index, four);
+    }
+#endif
+
+    for (; i < n; i++) {
+        out[i] = start + slope * i;
+    }
+}
+
+static int point_compare(const void *a, const void *b) {
+    uint64_t fa = ((const Param_Point *) a)->frame;
+    uint64_t fb = ((const Param_Point *) b)->frame;
+    return fa < fb ? -1 : fa > fb;
+}
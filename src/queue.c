@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include <SDL.h>
+
+#include <aleph/queue.h>
+
+/* Each cell's sequence number says whose turn it is: equal to a push
+ * position when free for that push, one past it once filled for the
+ * matching pop. Positions only ever grow and are compared by difference,
+ * so they may wrap. */
+#define CELL_DATA 16
+
+#define CACHE_LINE 64
+
+struct Queue {
+    uint8_t *cells;
+    size_t elem_size, cell_size;
+    unsigned mask;
+
+    SDL_atomic_t head;
+    char pad[CACHE_LINE - sizeof(SDL_atomic_t)];
+    SDL_atomic_t tail;
+};
+
+static SDL_atomic_t *cell_seq(Queue *queue, unsigned pos);
+
+Queue *queue_create(size_t elem_size, size_t capacity) {
+    unsigned size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    Queue *queue = NEW(Queue);
+    queue->elem_size = elem_size;
+    queue->cell_size = (CELL_DATA + elem_size + 15) & ~((size_t) 15);
+    queue->mask = size - 1;
+    queue->cells = NEW_ARR(uint8_t, queue->cell_size * size);
+
+    for (unsigned i = 0; i < size; i++) {
+        SDL_AtomicSet(cell_seq(queue, i), i);
+    }
+    SDL_AtomicSet(&queue->head, 0);
+    SDL_AtomicSet(&queue->tail, 0);
+
+    return queue;
+}
+
+void queue_free(Queue *queue) {
+    FREE(queue->cells);
+    FREE(queue);
+}
+
+bool queue_push(Queue *queue, const void *elem) {
+    unsigned pos = SDL_AtomicGet(&queue->head);
+    SDL_atomic_t *seq;
+
+    for (;;) {
+        seq = cell_seq(queue, pos);
+        int diff = (int) ((unsigned) SDL_AtomicGet(seq) - pos);
+        if (diff == 0) {
+            if (SDL_AtomicCAS(&queue->head, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        }
+        pos = SDL_AtomicGet(&queue->head);
+    }
+
+    memcpy((uint8_t *) seq + CELL_DATA, elem, queue->elem_size);
+    SDL_AtomicSet(seq, pos + 1);
+
+    return true;
+}
+
+bool queue_pop(Queue *queue, void *elem) {
+    unsigned pos = SDL_AtomicGet(&queue->tail);
+    SDL_atomic_t *seq;
+
+    for (;;) {
+        seq = cell_seq(queue, pos);
+        int diff = (int) ((unsigned) SDL_AtomicGet(seq) - (pos + 1));
+        if (diff == 0) {
+            if (SDL_AtomicCAS(&queue->tail, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        }
+        pos = SDL_AtomicGet(&queue->tail);
+    }
+
+    memcpy(elem, (uint8_t *) seq + CELL_DATA, queue->elem_size);
+    SDL_AtomicSet(seq, pos + queue->mask + 1);
+
+    return true;
+}
+
+static SDL_atomic_t *cell_seq(Queue *queue, unsigned pos) {
+    return (SDL_atomic_t *) &queue->cells[(pos & queue->mask) * queue->cell_size];
+}
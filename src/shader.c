@@ -5,16 +5,22 @@
 
 #include <aleph/shader.h>
 #include <aleph/membuf.h>
+#include <aleph/alloc.h>
 
 bool shader_load(Shader *shader, const char *vert_path, const char *frag_path) {
+    Arena arena;
+    arena_init(&arena, 16 * 1024);
+
     Membuf vert_buf, frag_buf;
-    if (!membuf_load(&vert_buf, vert_path)) {
+    if (!membuf_load_arena(&vert_buf, &arena, vert_path)) {
         printf("cannot load %s\n", vert_path);
+        arena_free(&arena);
         return false;
     }
 
-    if (!membuf_load(&frag_buf, frag_path)) {
+    if (!membuf_load_arena(&frag_buf, &arena, frag_path)) {
         printf("cannot load %s\n", frag_path);
+        arena_free(&arena);
         return false;
     }
 
@@ -54,6 +60,10 @@ bool shader_load(Shader *shader, const char *vert_path, const char *frag_path) {
         exit(EXIT_FAILURE);
     }
 
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    arena_free(&arena);
+
     glUseProgram(shader->id);
 
     return true;
@@ -61,4 +71,4 @@ bool shader_load(Shader *shader, const char *vert_path, const char *frag_path) {
 
 void shader_free(Shader *shader) {
     glDeleteProgram(shader->id);
-}
\ No newline at end of file
+}
\ No newline at end of file
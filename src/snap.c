@@ -0,0 +1,453 @@
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SNAP_SSE
+#endif
+
+#include <aleph/snap.h>
+#include <aleph/workers.h>
+
+/* Levels are one byte each: half dB steps up from LEVEL_FLOOR_DB. */
+#define LEVEL_FLOOR_DB -127.5f
+#define LEVEL_STEPS_PER_DB 2.0f
+
+/* Frames per build task, a whole number of windows. */
+#define CHUNK_FRAMES (SNAP_WINDOW * 4096)
+
+/* Tree key of a window with no crossings, louder than any level. */
+#define NO_CROSSING 256
+#define NO_WINDOW ((size_t) -1)
+
+struct Snap_Index {
+    uint32_t *crossings;
+    size_t ncrossings;
+    uint8_t *levels; /* One per SNAP_WINDOW frames. */
+    size_t nwindows;
+    size_t frames;
+
+    /* Min-tree over the windows, keyed by level where they hold a
+     * crossing, so the quietest in a range is found without visiting
+     * them. Leaves start at `leaves`, a power of two. */
+    uint16_t *tree;
+    size_t leaves;
+};
+
+typedef struct {
+    size_t at;
+    int level;
+    size_t dist;
+} Snap_Pick;
+
+/* The build makes two passes over each chunk: one counting crossings and
+ * measuring levels, then, with every chunk's offset known, one writing the
+ * crossings into place. */
+typedef struct {
+    const Audio_File *file;
+    Snap_Index *index;
+    size_t *counts; /* Per chunk; offsets after the first pass. */
+    bool fill;
+} Snap_Build;
+
+static void build_task(void *ud, size_t chunk);
+static size_t scan_chunk(const Snap_Build *build, size_t chunk, uint32_t *out);
+static uint32_t sign_bits(const float *data, int nchannels, size_t frame, size_t n, float *sumsq);
+static uint8_t level_code(float mean_square);
+static void tree_build(Snap_Index *index);
+static int tree_min(const Snap_Index *index, size_t first, size_t last);
+static size_t tree_find(const Snap_Index *index, size_t node, size_t node_first, size_t node_last,
+    size_t first, size_t last, int level, bool from_end);
+static void pick_in_window(const Snap_Index *index, size_t window, size_t lo, size_t hi,
+    size_t frame, Snap_Pick *pick);
+static size_t first_at_or_after(const Snap_Index *index, size_t frame);
+static int ctz32(uint32_t v);
+static int popcount32(uint32_t v);
+
+Snap_Index *snap_build(const Audio_File *file) {
+    Snap_Index *index = NEW(Snap_Index);
+    index->frames = file->len / file->nchannels;
+    index->nwindows = (index->frames + SNAP_WINDOW - 1) / SNAP_WINDOW;
+    index->levels = NEW_ARR(uint8_t, index->nwindows ? index->nwindows : 1);
+
+    size_t nchunks = (index->frames + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+    Snap_Build build = {
+        .file = file,
+        .index = index,
+        .counts = NEW_ARR(size_t, nchunks ? nchunks : 1),
+        .fill = false,
+    };
+
+    Worker_Pool *pool = workers_create(0, false);
+    workers_run(pool, nchunks, build_task, &build);
+
+    size_t total = 0;
+    for (size_t i = 0; i < nchunks; i++) {
+        size_t count = build.counts[i];
+        build.counts[i] = total;
+        total += count;
+    }
+
+    index->ncrossings = total;
+    index->crossings = NEW_ARR(uint32_t, total ? total : 1);
+    build.fill = true;
+    workers_run(pool, nchunks, build_task, &build);
+    workers_free(pool);
+
+    FREE(build.counts);
+
+    tree_build(index);
+
+    LOG_FMT("indexed %d zero crossings over %d frames", (int) total, (int) index->frames);
+    return index;
+}
+
+void snap_free(Snap_Index *index) {
+    FREE(index->crossings);
+    FREE(index->levels);
+    FREE(index->tree);
+    FREE(index);
+}
+
+size_t snap_crossing(const Snap_Index *index, size_t frame) {
+    if (index->ncrossings == 0) {
+        return frame;
+    }
+
+    size_t i = first_at_or_after(index, frame);
+    if (i == index->ncrossings) {
+        return index->crossings[i - 1];
+    }
+
+    size_t after = index->crossings[i];
+    if (i == 0) {
+        return after;
+    }
+
+    size_t before = index->crossings[i - 1];
+    return frame - before <= after - frame ? before : after;
+}
+
+/* The windows at either end may stick out of the radius, so they are
+ * looked at through their crossings. Between them every crossing counts:
+ * the tree gives the quietest level there, and the pick is in the window
+ * holding `frame` or the nearest at that level to either side of it. */
+size_t snap_quiet(const Snap_Index *index, size_t frame, size_t radius) {
+    size_t lo = frame > radius ? frame - radius : 0;
+    size_t hi = frame + radius < frame ? (size_t) -1 : frame + radius;
+
+    size_t first = first_at_or_after(index, lo);
+    if (first == index->ncrossings || index->crossings[first] > hi) {
+        return frame;
+    }
+
+    size_t last = hi < index->crossings[index->ncrossings - 1] ? first_at_or_after(index, hi + 1) - 1
+        : index->ncrossings - 1;
+    size_t first_window = index->crossings[first] / SNAP_WINDOW;
+    size_t last_window = index->crossings[last] / SNAP_WINDOW;
+
+    Snap_Pick pick = {frame, NO_CROSSING, 0};
+    pick_in_window(index, first_window, lo, hi, frame, &pick);
+    if (last_window != first_window) {
+        pick_in_window(index, last_window, lo, hi, frame, &pick);
+    }
+
+    if (last_window - first_window >= 2) {
+        size_t inner_first = first_window + 1;
+        size_t inner_last = last_window - 1;
+        int level = tree_min(index, inner_first, inner_last);
+        if (level < NO_CROSSING) {
+            size_t at = frame / SNAP_WINDOW;
+            at = at < inner_first ? inner_first : (at > inner_last ? inner_last : at);
+
+            if (index->tree[index->leaves + at] == level) {
+                pick_in_window(index, at, lo, hi, frame, &pick);
+            }
+            if (at > inner_first) {
+                size_t before = tree_find(index, 1, 0, index->leaves - 1, inner_first, at - 1, level, true);
+                if (before != NO_WINDOW) {
+                    pick_in_window(index, before, lo, hi, frame, &pick);
+                }
+            }
+            if (at < inner_last) {
+                size_t after = tree_find(index, 1, 0, index->leaves - 1, at + 1, inner_last, level, false);
+                if (after != NO_WINDOW) {
+                    pick_in_window(index, after, lo, hi, frame, &pick);
+                }
+            }
+        }
+    }
+
+    return pick.at;
+}
+
+float snap_level_db(const Snap_Index *index, size_t frame) {
+    if (index->nwindows == 0) {
+        return LEVEL_FLOOR_DB;
+    }
+
+    size_t window = frame / SNAP_WINDOW;
+    if (window >= index->nwindows) {
+        window = index->nwindows - 1;
+    }
+    return LEVEL_FLOOR_DB + index->levels[window] / LEVEL_STEPS_PER_DB;
+}
+
+static void build_task(void *ud, size_t chunk) {
+    Snap_Build *build = (Snap_Build *) ud;
+    if (build->fill) {
+        scan_chunk(build, chunk, &build->index->crossings[build->counts[chunk]]);
+    } else {
+        build->counts[chunk] = scan_chunk(build, chunk, NULL);
+    }
+}
+
+/* Counts the chunk's crossings, writing them to `out` if given, and its
+ * window levels if not. */
+static size_t scan_chunk(const Snap_Build *build, size_t chunk, uint32_t *out) {
+    const Audio_File *file = build->file;
+    Snap_Index *index = build->index;
+
+    size_t start = chunk * CHUNK_FRAMES;
+    size_t end = start + CHUNK_FRAMES < index->frames ? start + CHUNK_FRAMES : index->frames;
+
+    /* Whether the frame before this chunk was negative. */
+    uint32_t prev = 0;
+    if (start > 0) {
+        float unused;
+        prev = sign_bits(file->data.f32, file->nchannels, start - 1, 1, &unused);
+    }
+
+    size_t count = 0;
+    for (size_t window = start; window < end; window += SNAP_WINDOW) {
+        size_t window_end = window + SNAP_WINDOW < end ? window + SNAP_WINDOW : end;
+        float sumsq = 0.0f;
+
+        for (size_t frame = window; frame < window_end; frame += 32) {
+            size_t n = window_end - frame < 32 ? window_end - frame : 32;
+            float part;
+            uint32_t neg = sign_bits(file->data.f32, file->nchannels, frame, n, &part);
+            sumsq += part;
+
+            /* Bit i set where frame i differs in sign from the one before. */
+            uint32_t changed = neg ^ ((neg << 1) | prev);
+            if (n < 32) {
+                changed &= ((uint32_t) 1 << n) - 1;
+            }
+            prev = (neg >> (n - 1)) & 1;
+
+            if (!out) {
+                count += popcount32(changed);
+                continue;
+            }
+
+            while (changed) {
+                out[count++] = (uint32_t) (frame + ctz32(changed));
+                changed &= changed - 1;
+            }
+        }
+
+        if (!out) {
+            float frames = (float) ((window_end - window) * file->nchannels);
+            index->levels[window / SNAP_WINDOW] = level_code(sumsq / frames);
+        }
+    }
+
+    return count;
+}
+
+/* Bit i set where the channel sum of frame + i is negative, for up to 32
+ * frames. Adds up the squares of every sample on the way. */
+static uint32_t sign_bits(const float *data, int nchannels, size_t frame, size_t n, float *sumsq) {
+    uint32_t bits = 0;
+    size_t i = 0;
+    float sum = 0.0f;
+
+#ifdef SNAP_SSE
+    if (nchannels == 2) {
+        const float *p = &data[frame * 2];
+        __m128 zero = _mm_setzero_ps();
+        __m128 vsum = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            __m128 a = _mm_loadu_ps(&p[i * 2]);
+            __m128 b = _mm_loadu_ps(&p[i * 2 + 4]);
+            __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            __m128 mono = _mm_add_ps(left, right);
+            bits |= (uint32_t) _mm_movemask_ps(_mm_cmplt_ps(mono, zero)) << i;
+            vsum = _mm_add_ps(vsum, _mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)));
+        }
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, vsum);
+        sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+
+    for (; i < n; i++) {
+        const float *f = &data[(frame + i) * nchannels];
+        float mono = 0.0f;
+        for (int c = 0; c < nchannels; c++) {
+            mono += f[c];
+            sum += f[c] * f[c];
+        }
+        if (mono < 0.0f) {
+            bits |= (uint32_t) 1 << i;
+        }
+    }
+
+    *sumsq = sum;
+    return bits;
+}
+
+static uint8_t level_code(float mean_square) {
+    if (mean_square <= 0.0f) {
+        return 0;
+    }
+
+    float db = 10.0f * log10f(mean_square);
+    float code = (db - LEVEL_FLOOR_DB) * LEVEL_STEPS_PER_DB + 0.5f;
+    if (code < 0.0f) {
+        return 0;
+    }
+    return code > 255.0f ? 255 : (uint8_t) code;
+}
+
+static void tree_build(Snap_Index *index) {
+    index->leaves = 1;
+    while (index->leaves < index->nwindows) {
+        index->leaves <<= 1;
+    }
+
+    uint16_t *tree = NEW_ARR(uint16_t, index->leaves * 2);
+    for (size_t i = 0; i < index->leaves; i++) {
+        tree[index->leaves + i] = NO_CROSSING;
+    }
+    for (size_t i = 0; i < index->ncrossings; i++) {
+        size_t window = index->crossings[i] / SNAP_WINDOW;
+        tree[index->leaves + window] = index->levels[window];
+    }
+    for (size_t node = index->leaves - 1; node > 0; node--) {
+        uint16_t a = tree[node * 2], b = tree[node * 2 + 1];
+        tree[node] = a < b ? a : b;
+    }
+
+    index->tree = tree;
+}
+
+/* Quietest key over windows `first` to `last`, inclusive. */
+static int tree_min(const Snap_Index *index, size_t first, size_t last) {
+    int min = NO_CROSSING;
+    size_t a = first + index->leaves, b = last + index->leaves + 1;
+    while (a < b) {
+        if (a & 1) {
+            min = index->tree[a] < min ? index->tree[a] : min;
+            a++;
+        }
+        if (b & 1) {
+            b--;
+            min = index->tree[b] < min ? index->tree[b] : min;
+        }
+        a >>= 1;
+        b >>= 1;
+    }
+
+    return min;
+}
+
+/* The first window of `first` to `last` keyed at or under `level`, or the
+ * last with `from_end`, under `node`, which spans windows `node_first` to
+ * `node_last`. Only subtrees that can hold one are entered. */
+static size_t tree_find(const Snap_Index *index, size_t node, size_t node_first, size_t node_last,
+    size_t first, size_t last, int level, bool from_end) {
+    if (node_last < first || node_first > last || index->tree[node] > level) {
+        return NO_WINDOW;
+    }
+    if (node_first == node_last) {
+        return node_first;
+    }
+
+    size_t mid = node_first + (node_last - node_first) / 2;
+    size_t found;
+    if (from_end) {
+        found = tree_find(index, node * 2 + 1, mid + 1, node_last, first, last, level, true);
+        if (found == NO_WINDOW) {
+            found = tree_find(index, node * 2, node_first, mid, first, last, level, true);
+        }
+    } else {
+        found = tree_find(index, node * 2, node_first, mid, first, last, level, false);
+        if (found == NO_WINDOW) {
+            found = tree_find(index, node * 2 + 1, mid + 1, node_last, first, last, level, false);
+        }
+    }
+
+    return found;
+}
+
+/* Weighs the crossings of `window` between `lo` and `hi` nearest `frame`
+ * against the pick so far: quieter wins, then nearer, then earlier. */
+static void pick_in_window(const Snap_Index *index, size_t window, size_t lo, size_t hi,
+    size_t frame, Snap_Pick *pick) {
+    size_t from = window * SNAP_WINDOW;
+    size_t to = from + SNAP_WINDOW - 1;
+    from = from > lo ? from : lo;
+    to = to < hi ? to : hi;
+
+    size_t first = first_at_or_after(index, from);
+    size_t i = first_at_or_after(index, frame < from ? from : (frame > to ? to : frame));
+
+    size_t candidates[2];
+    int count = 0;
+    if (i > first) {
+        candidates[count++] = index->crossings[i - 1];
+    }
+    if (i < index->ncrossings && index->crossings[i] <= to) {
+        candidates[count++] = index->crossings[i];
+    }
+
+    int level = index->levels[window];
+    for (int c = 0; c < count; c++) {
+        size_t at = candidates[c];
+        size_t dist = at > frame ? at - frame : frame - at;
+        if (level < pick->level || (level == pick->level
+            && (dist < pick->dist || (dist == pick->dist && at < pick->at)))) {
+            pick->at = at;
+            pick->level = level;
+            pick->dist = dist;
+        }
+    }
+}
+
+static size_t first_at_or_after(const Snap_Index *index, size_t frame) {
+    size_t lo = 0, hi = index->ncrossings;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->crossings[mid] < frame) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int ctz32(uint32_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctz(v);
+#else
+    int zeros = 0;
+    while (!(v & ((uint32_t) 1 << zeros))) {
+        zeros++;
+    }
+    return zeros;
+#endif
+}
+
+static int popcount32(uint32_t v) {
+#if defined(__GNUC__)
+    return __builtin_popcount(v);
+#else
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (int) ((((v + (v >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24);
+#endif
+}
@@ -0,0 +1,510 @@
+#include <math.h>
+
+#include <SDL.h>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <aleph/fft.h>
+#include <aleph/spectrogram.h>
+
+#define FFT_SIZE 1024
+#define NUM_BINS (FFT_SIZE / 2 + 1)
+
+#define TILE_COLS 256
+#define TILE_ROWS 256
+
+/* Level 0 has a column every BASE_HOP frames and every level above doubles
+ * that. Columns on coarse levels average a few FFTs spread over their hop,
+ * so computing a tile costs about the same at any level. */
+#define BASE_HOP 64
+#define NUM_LEVELS 16
+#define MAX_SUBFRAMES 4
+
+#define MAX_TILES 96
+#define MAX_THREADS 4
+#define MAX_UPLOADS_PER_FRAME 4
+#define FALLBACK_LEVELS 4
+
+/* Queued tiles just outside the view get computed after the visible ones. */
+#define PREFETCH_PRIORITY 1000
+
+#define MIN_DB -100.0f
+#define MIN_FREQ 20.0f
+
+typedef enum {
+    TILE_EMPTY,
+    TILE_QUEUED,
+    TILE_COMPUTING,
+    TILE_READY,
+    TILE_UPLOADED,
+} Tile_State;
+
+typedef struct {
+    Tile_State state;
+    int level;
+    size_t index;
+    int priority;
+    uint64_t last_used;
+    uint8_t *pixels;
+    GLuint texture;
+} Tile;
+
+typedef struct {
+    float lo, hi; /* Range of FFT bins covered by one row of a tile. */
+} Row_Bins;
+
+struct {
+    const Audio_File *file;
+    size_t frames;
+
+    Tile tiles[MAX_TILES];
+    SDL_mutex *lock;
+    SDL_cond *wake;
+    bool quit;
+
+    SDL_Thread *threads[MAX_THREADS];
+    int nthreads;
+
+    float window[FFT_SIZE];
+    Row_Bins rows[TILE_ROWS];
+    uint8_t colors[256][4];
+
+    uint64_t frame;
+} spec;
+
+static int spectrogram_thread(void *ud);
+static void tile_compute(uint8_t *pixels, int level, size_t index, Fft *fft,
+    float *buf, float *power);
+static Tile *tile_find(int level, size_t index);
+static Tile *tile_next_queued();
+static void tile_request(int level, size_t index, int priority);
+static void tile_draw(int level, size_t index, size_t start, size_t zoom,
+    size_t width, float x0, float x1, float y0, float y1);
+static void tile_upload(Tile *tile);
+static void build_colors();
+
+void spectrogram_init(const Audio_File *file) {
+    spec.file = file;
+    spec.frames = file->len / file->nchannels;
+    spec.quit = false;
+    spec.frame = 0;
+
+    for (int i = 0; i < FFT_SIZE; i++) {
+        spec.window[i] = 0.5f - 0.5f * cosf(2.0f * 3.14159265f * i / FFT_SIZE);
+    }
+
+    float bin_hz = ((float) file->sample_rate) / FFT_SIZE;
+    float max_freq = file->sample_rate / 2.0f;
+    for (int row = 0; row < TILE_ROWS; row++) {
+        float lo = MIN_FREQ * powf(max_freq / MIN_FREQ, ((float) row) / TILE_ROWS);
+        float hi = MIN_FREQ * powf(max_freq / MIN_FREQ, ((float) row + 1) / TILE_ROWS);
+        spec.rows[row].lo = lo / bin_hz;
+        spec.rows[row].hi = hi / bin_hz;
+    }
+
+    build_colors();
+
+    for (int i = 0; i < MAX_TILES; i++) {
+        Tile *tile = &spec.tiles[i];
+        tile->state = TILE_EMPTY;
+        tile->pixels = NEW_ARR(uint8_t, TILE_COLS * TILE_ROWS * 4);
+        tile->texture = 0;
+    }
+
+    spec.lock = SDL_CreateMutex();
+    spec.wake = SDL_CreateCond();
+
+    spec.nthreads = SDL_GetCPUCount() - 1;
+    if (spec.nthreads < 1) {
+        spec.nthreads = 1;
+    }
+    if (spec.nthreads > MAX_THREADS) {
+        spec.nthreads = MAX_THREADS;
+    }
+
+    for (int i = 0; i < spec.nthreads; i++) {
+        spec.threads[i] = SDL_CreateThread(spectrogram_thread, "spectrogram", NULL);
+    }
+}
+
+void spectrogram_free() {
+    SDL_LockMutex(spec.lock);
+    spec.quit = true;
+    SDL_CondBroadcast(spec.wake);
+    SDL_UnlockMutex(spec.lock);
+
+    for (int i = 0; i < spec.nthreads; i++) {
+        SDL_WaitThread(spec.threads[i], NULL);
+    }
+
+    for (int i = 0; i < MAX_TILES; i++) {
+        Tile *tile = &spec.tiles[i];
+        if (tile->texture) {
+            glDeleteTextures(1, &tile->texture);
+        }
+        FREE(tile->pixels);
+    }
+
+    SDL_DestroyCond(spec.wake);
+    SDL_DestroyMutex(spec.lock);
+}
+
+void spectrogram_draw(size_t start, size_t zoom, size_t width,
+    float x0, float x1, float y0, float y1) {
+
+    spec.frame++;
+
+    int level = 0;
+    while (((size_t) BASE_HOP << level) < zoom && level < NUM_LEVELS - 1) {
+        level++;
+    }
+
+    size_t tile_frames = ((size_t) BASE_HOP << level) * TILE_COLS;
+    size_t first_frame = start * zoom;
+    size_t last_frame = (start + width) * zoom;
+    if (last_frame > spec.frames) {
+        last_frame = spec.frames;
+    }
+
+    if (first_frame >= last_frame) {
+        return;
+    }
+
+    size_t first = first_frame / tile_frames;
+    size_t last = (last_frame - 1) / tile_frames;
+    size_t center = (first + last) / 2;
+    size_t ntiles = (spec.frames + tile_frames - 1) / tile_frames;
+
+    Tile *uploads[MAX_UPLOADS_PER_FRAME];
+    int nuploads = 0;
+
+    SDL_LockMutex(spec.lock);
+
+    for (size_t i = first; i <= last; i++) {
+        tile_request(level, i, i > center ? i - center : center - i);
+    }
+
+    if (first > 0) {
+        tile_request(level, first - 1, PREFETCH_PRIORITY);
+    }
+    if (last + 1 < ntiles) {
+        tile_request(level, last + 1, PREFETCH_PRIORITY);
+    }
+
+    for (int i = 0; i < MAX_TILES; i++) {
+        Tile *tile = &spec.tiles[i];
+        if (tile->state == TILE_QUEUED && tile->last_used != spec.frame) {
+            tile->state = TILE_EMPTY;
+        } else if (tile->state == TILE_READY && nuploads < MAX_UPLOADS_PER_FRAME) {
+            uploads[nuploads++] = tile;
+        }
+    }
+
+    SDL_CondBroadcast(spec.wake);
+    SDL_UnlockMutex(spec.lock);
+
+    /* Workers never touch READY tiles, so these are safe to read unlocked. */
+    for (int i = 0; i < nuploads; i++) {
+        tile_upload(uploads[i]);
+    }
+
+    SDL_LockMutex(spec.lock);
+
+    for (int i = 0; i < nuploads; i++) {
+        uploads[i]->state = TILE_UPLOADED;
+    }
+
+    glEnable(GL_TEXTURE_2D);
+    glColor3f(1.0f, 1.0f, 1.0f);
+    for (size_t i = first; i <= last; i++) {
+        tile_draw(level, i, start, zoom, width, x0, x1, y0, y1);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_2D);
+
+    SDL_UnlockMutex(spec.lock);
+}
+
+static int spectrogram_thread(void *ud) {
+    IGNORE(ud);
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    Fft fft;
+    fft_init(&fft, FFT_SIZE);
+    float *buf = NEW_ARR(float, FFT_SIZE * 2);
+    float *power = NEW_ARR(float, NUM_BINS);
+
+    SDL_LockMutex(spec.lock);
+    while (!spec.quit) {
+        Tile *tile = tile_next_queued();
+        if (!tile) {
+            SDL_CondWait(spec.wake, spec.lock);
+            continue;
+        }
+
+        tile->state = TILE_COMPUTING;
+        int level = tile->level;
+        size_t index = tile->index;
+        SDL_UnlockMutex(spec.lock);
+
+        tile_compute(tile->pixels, level, index, &fft, buf, power);
+
+        SDL_LockMutex(spec.lock);
+        tile->state = TILE_READY;
+    }
+    SDL_UnlockMutex(spec.lock);
+
+    FREE(power);
+    FREE(buf);
+    fft_free(&fft);
+
+    return 0;
+}
+
+static void tile_compute(uint8_t *pixels, int level, size_t index, Fft *fft,
+    float *buf, float *power) {
+
+    const float *data = spec.file->data.f32;
+    int nchannels = spec.file->nchannels;
+
+    size_t hop = (size_t) BASE_HOP << level;
+    size_t nsub = hop / FFT_SIZE;
+    if (nsub < 1) {
+        nsub = 1;
+    }
+    if (nsub > MAX_SUBFRAMES) {
+        nsub = MAX_SUBFRAMES;
+    }
+
+    /* A full scale sine through a Hann window peaks at (FFT_SIZE / 4)^2. */
+    float norm = 1.0f / (nsub * (FFT_SIZE / 4.0f) * (FFT_SIZE / 4.0f) * nchannels * nchannels);
+
+    for (size_t col = 0; col < TILE_COLS; col++) {
+        size_t col_start = (index * TILE_COLS + col) * hop;
+        if (col_start >= spec.frames) {
+            for (int row = 0; row < TILE_ROWS; row++) {
+                memcpy(&pixels[(row * TILE_COLS + col) * 4], spec.colors[0], 4);
+            }
+            continue;
+        }
+
+        for (int bin = 0; bin < NUM_BINS; bin++) {
+            power[bin] = 0.0f;
+        }
+
+        for (size_t sub = 0; sub < nsub; sub++) {
+            size_t center = col_start + ((2 * sub + 1) * hop) / (2 * nsub);
+            for (int i = 0; i < FFT_SIZE; i++) {
+                size_t frame = center + i - FFT_SIZE / 2;
+                float sample = 0.0f;
+                if (center + i >= FFT_SIZE / 2 && frame < spec.frames) {
+                    for (int c = 0; c < nchannels; c++) {
+                        sample += data[frame * nchannels + c];
+                    }
+                }
+                buf[i * 2] = sample * spec.window[i];
+                buf[i * 2 + 1] = 0.0f;
+            }
+
+            fft_forward(fft, buf);
+
+            for (int bin = 0; bin < NUM_BINS; bin++) {
+                float re = buf[bin * 2];
+                float im = buf[bin * 2 + 1];
+                power[bin] += re * re + im * im;
+            }
+        }
+
+        for (int row = 0; row < TILE_ROWS; row++) {
+            Row_Bins *rb = &spec.rows[row];
+            float p;
+            if (rb->hi - rb->lo < 1.0f) {
+                /* Low rows are narrower than a bin: interpolate. */
+                float pos = (rb->lo + rb->hi) * 0.5f;
+                int bin = (int) pos;
+                float t = pos - bin;
+                int next = bin + 1 < NUM_BINS ? bin + 1 : bin;
+                p = power[bin] * (1.0f - t) + power[next] * t;
+            } else {
+                int lo = (int) rb->lo;
+                int hi = (int) ceilf(rb->hi);
+                if (hi > NUM_BINS) {
+                    hi = NUM_BINS;
+                }
+                p = 0.0f;
+                for (int bin = lo; bin < hi; bin++) {
+                    if (power[bin] > p) {
+                        p = power[bin];
+                    }
+                }
+            }
+
+            float db = 10.0f * log10f(p * norm + 1e-20f);
+            int color = (int) ((db - MIN_DB) / -MIN_DB * 255.0f);
+            if (color < 0) color = 0;
+            if (color > 255) color = 255;
+            memcpy(&pixels[(row * TILE_COLS + col) * 4], spec.colors[color], 4);
+        }
+    }
+}
+
+static Tile *tile_find(int level, size_t index) {
+    for (int i = 0; i < MAX_TILES; i++) {
+        Tile *tile = &spec.tiles[i];
+        if (tile->state != TILE_EMPTY && tile->level == level && tile->index == index) {
+            return tile;
+        }
+    }
+
+    return NULL;
+}
+
+static Tile *tile_next_queued() {
+    Tile *best = NULL;
+    for (int i = 0; i < MAX_TILES; i++) {
+        Tile *tile = &spec.tiles[i];
+        if (tile->state == TILE_QUEUED && (!best || tile->priority < best->priority)) {
+            best = tile;
+        }
+    }
+
+    return best;
+}
+
+static void tile_request(int level, size_t index, int priority) {
+    Tile *tile = tile_find(level, index);
+    if (tile) {
+        tile->last_used = spec.frame;
+        if (tile->state == TILE_QUEUED) {
+            tile->priority = priority;
+        }
+        return;
+    }
+
+    /* Reuse an empty slot, or else the least recently drawn tile that is not
+     * being computed and hasn't been asked for this frame. */
+    Tile *victim = NULL;
+    for (int i = 0; i < MAX_TILES; i++) {
+        Tile *cand = &spec.tiles[i];
+        if (cand->state == TILE_EMPTY) {
+            victim = cand;
+            break;
+        }
+
+        if (cand->state == TILE_COMPUTING || cand->last_used == spec.frame) {
+            continue;
+        }
+
+        if (!victim || cand->last_used < victim->last_used) {
+            victim = cand;
+        }
+    }
+
+    if (!victim) {
+        return;
+    }
+
+    victim->state = TILE_QUEUED;
+    victim->level = level;
+    victim->index = index;
+    victim->priority = priority;
+    victim->last_used = spec.frame;
+}
+
+static void tile_draw(int level, size_t index, size_t start, size_t zoom,
+    size_t width, float x0, float x1, float y0, float y1) {
+
+    /* Until this tile is ready, stretch part of a coarser one over it. */
+    Tile *tile = NULL;
+    float u0 = 0.0f, u1 = 1.0f;
+    for (int k = 0; k <= FALLBACK_LEVELS && level + k < NUM_LEVELS; k++) {
+        Tile *cand = tile_find(level + k, index >> k);
+        if (cand && cand->state == TILE_UPLOADED) {
+            size_t parts = (size_t) 1 << k;
+            size_t part = index & (parts - 1);
+            u0 = ((float) part) / parts;
+            u1 = ((float) part + 1) / parts;
+            tile = cand;
+            break;
+        }
+    }
+
+    if (!tile) {
+        return;
+    }
+
+    tile->last_used = spec.frame;
+
+    double tile_frames = ((double) ((size_t) BASE_HOP << level)) * TILE_COLS;
+    double f0 = index * tile_frames;
+    double f1 = f0 + tile_frames;
+    double v0 = ((double) start) * zoom;
+    double v1 = ((double) start + width) * zoom;
+
+    double c0 = f0 > v0 ? f0 : v0;
+    double c1 = f1 < v1 ? f1 : v1;
+    if (c0 >= c1) {
+        return;
+    }
+
+    float tu0 = u0 + (u1 - u0) * (c0 - f0) / tile_frames;
+    float tu1 = u0 + (u1 - u0) * (c1 - f0) / tile_frames;
+    float qx0 = x0 + (x1 - x0) * (c0 - v0) / (v1 - v0);
+    float qx1 = x0 + (x1 - x0) * (c1 - v0) / (v1 - v0);
+
+    glBindTexture(GL_TEXTURE_2D, tile->texture);
+    glBegin(GL_QUADS);
+    glTexCoord2f(tu0, 0.0f);
+    glVertex2f(qx0, y0);
+    glTexCoord2f(tu1, 0.0f);
+    glVertex2f(qx1, y0);
+    glTexCoord2f(tu1, 1.0f);
+    glVertex2f(qx1, y1);
+    glTexCoord2f(tu0, 1.0f);
+    glVertex2f(qx0, y1);
+    glEnd();
+}
+
+static void tile_upload(Tile *tile) {
+    if (!tile->texture) {
+        glGenTextures(1, &tile->texture);
+        glBindTexture(GL_TEXTURE_2D, tile->texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, tile->texture);
+    }
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TILE_COLS, TILE_ROWS, 0, GL_RGBA,
+        GL_UNSIGNED_BYTE, tile->pixels);
+}
+
+static void build_colors() {
+    static const float stops[][4] = {
+        {0.00f, 0.0f, 0.0f, 0.0f},
+        {0.25f, 0.08f, 0.04f, 0.32f},
+        {0.50f, 0.60f, 0.08f, 0.48f},
+        {0.75f, 0.95f, 0.48f, 0.12f},
+        {1.00f, 1.0f, 0.98f, 0.86f},
+    };
+
+    int nstops = sizeof(stops) / sizeof(stops[0]);
+    for (int i = 0; i < 256; i++) {
+        float t = i / 255.0f;
+        int s = 0;
+        while (s < nstops - 2 && t > stops[s + 1][0]) {
+            s++;
+        }
+
+        float f = (t - stops[s][0]) / (stops[s + 1][0] - stops[s][0]);
+        for (int c = 0; c < 3; c++) {
+            float v = stops[s][c + 1] + (stops[s + 1][c + 1] - stops[s][c + 1]) * f;
+            spec.colors[i][c] = (uint8_t) (v * 255.0f);
+        }
+        spec.colors[i][3] = 255;
+    }
+}
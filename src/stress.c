@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <math.h>
+
+#include <SDL.h>
+
+#include <aleph/audio.h>
+#include <aleph/stress.h>
+
+/* A stage passes while its 99.9th percentile block fits in this much of
+ * the deadline; the rest is left for the OS and whatever else runs. */
+#define STRESS_HEADROOM 0.75
+
+#define WARMUP_MS 250
+#define RELEASE_MS 600
+
+#define STRESS_SENDS 4
+#define REVERB_SECONDS 2.0
+#define REVERB_MIX 0.3f
+
+#define MIN_LOOP_SECONDS 0.01
+#define MAX_LOOP_SECONDS 2.0
+
+#define MIN_STRETCH_SPEED 0.5f
+#define MAX_STRETCH_SPEED 2.0f
+
+typedef struct {
+    const char *name;
+    bool automate; /* Gliding volume and delay time on every voice. */
+    int sends; /* Voices are spread over this many reverb sends. */
+    bool chain; /* Each send feeds the next instead of going out. */
+    Stretch_Mode stretch; /* At a speed from MIN_STRETCH_SPEED to MAX_STRETCH_SPEED. */
+} Stress_Level;
+
+static const Stress_Level levels[] = {
+    {"dry", false, 0, false, STRETCH_OFF},
+    {"automated", true, 0, false, STRETCH_OFF},
+    {"reverb sends", true, STRESS_SENDS, false, STRETCH_OFF},
+    {"chained sends", true, STRESS_SENDS, true, STRETCH_OFF},
+    {"wsola", false, 0, false, STRETCH_WSOLA},
+    {"vocoder", false, 0, false, STRETCH_VOCODER},
+};
+
+#define NUM_LEVELS (sizeof(levels) / sizeof(levels[0]))
+
+static const int voice_steps[] = {1, 2, 4, 8, 16, 24, 32, 48, AUDIO_MAX_SLICES};
+
+#define NUM_STEPS (sizeof(voice_steps) / sizeof(voice_steps[0]))
+
+typedef struct {
+    double p50, p90, p99, p999;
+} Stress_Percentiles;
+
+static struct {
+    double stage_seconds;
+    Slice_Id voices[AUDIO_MAX_SLICES];
+    int nvoices;
+    uint32_t rng;
+    float *ir;
+    size_t ir_frames;
+} stress;
+
+static int stress_level(const Stress_Level *level, double *deadline_us);
+static void level_begin(const Stress_Level *level);
+static void level_end(const Stress_Level *level);
+static void voice_add(const Stress_Level *level);
+static void percentiles(const Audio_Timing *timing, Stress_Percentiles *out);
+static double percentile(const Audio_Timing *timing, double fraction);
+static void make_impulse();
+static float random_unit();
+
+void stress_run(double stage_seconds) {
+    stress.stage_seconds = stage_seconds > 0.0 ? stage_seconds : STRESS_STAGE_SECONDS;
+    stress.nvoices = 0;
+    stress.rng = 0x2545f491;
+    make_impulse();
+
+    printf("%-14s %6s %8s %8s %8s %8s %8s %6s\n",
+        "load", "voices", "p50", "p90", "p99", "p99.9", "max", "late");
+
+    int most[NUM_LEVELS];
+    double deadline_us = 0.0;
+    for (size_t i = 0; i < NUM_LEVELS; i++) {
+        most[i] = stress_level(&levels[i], &deadline_us);
+    }
+
+    printf("most voices sustained with the 99.9th percentile under %.0f us of a %.0f us block:\n",
+        deadline_us * STRESS_HEADROOM, deadline_us);
+    for (size_t i = 0; i < NUM_LEVELS; i++) {
+        const char *capped = most[i] == AUDIO_MAX_SLICES ? " (slice limit)" : "";
+        printf("  %-14s %d%s\n", levels[i].name, most[i], capped);
+    }
+
+    FREE(stress.ir);
+    stress.ir = NULL;
+}
+
+/* Returns the most voices the level sustained. */
+static int stress_level(const Stress_Level *level, double *deadline_us) {
+    level_begin(level);
+
+    int most = 0;
+    for (size_t step = 0; step < NUM_STEPS; step++) {
+        while (stress.nvoices < voice_steps[step]) {
+            voice_add(level);
+        }
+
+        SDL_Delay(WARMUP_MS);
+        audio_timing_start();
+        SDL_Delay((Uint32) (stress.stage_seconds * 1000));
+        const Audio_Timing *timing = audio_timing_stop();
+        *deadline_us = timing->deadline_us;
+
+        Stress_Percentiles p;
+        percentiles(timing, &p);
+        printf("%-14s %6d %6.0fus %6.0fus %6.0fus %6.0fus %6.0fus %6llu\n",
+            level->name, stress.nvoices, p.p50, p.p90, p.p99, p.p999, timing->max_us,
+            (unsigned long long) timing->late);
+
+        if (p.p999 > timing->deadline_us * STRESS_HEADROOM) {
+            break;
+        }
+        most = stress.nvoices;
+    }
+
+    level_end(level);
+    return most;
+}
+
+static void level_begin(const Stress_Level *level) {
+    for (int send = 0; send < level->sends; send++) {
+        audio_send_set_impulse(send, stress.ir, stress.ir_frames, 2, REVERB_MIX);
+        if (level->chain && send + 1 < level->sends) {
+            audio_send_set_output(send, send + 1);
+        }
+    }
+}
+
+static void level_end(const Stress_Level *level) {
+    for (int i = 0; i < stress.nvoices; i++) {
+        audio_slice_stop(stress.voices[i]);
+    }
+
+    SDL_Delay(RELEASE_MS);
+
+    for (int i = 0; i < stress.nvoices; i++) {
+        Slice_Id id = stress.voices[i];
+        audio_slice_set_stretch(id, STRETCH_OFF, 1.0f);
+        audio_slice_end(id);
+        audio_channel_automate(id, AUDIO_PARAM_VOLUME, NULL, 0);
+        audio_channel_set(id, AUDIO_PARAM_VOLUME, 1.0f);
+        audio_channel_set(id, AUDIO_PARAM_DELAY_TIME, 0.5f);
+    }
+    stress.nvoices = 0;
+
+    for (int send = 0; send < level->sends; send++) {
+        audio_send_set_reverb(send, NULL, 0.0f);
+        audio_send_set_output(send, -1);
+    }
+}
+
+/* A loop somewhere in the file, from a click to a couple of seconds long. */
+static void voice_add(const Stress_Level *level) {
+    const Audio_File *file = audio_get_file();
+    size_t len = file->len / file->nchannels;
+    size_t loop = (size_t) ((MIN_LOOP_SECONDS + random_unit() * (MAX_LOOP_SECONDS - MIN_LOOP_SECONDS))
+        * file->sample_rate);
+    if (loop >= len) {
+        loop = len - 1;
+    }
+    size_t start = (size_t) (random_unit() * (len - loop - 1));
+
+    Slice_Id id = audio_slice_begin(start, start + loop, true);
+    if (level->sends > 0) {
+        audio_slice_set_send(id, stress.nvoices % level->sends);
+    }
+
+    if (level->stretch != STRETCH_OFF) {
+        float speed = MIN_STRETCH_SPEED + random_unit() * (MAX_STRETCH_SPEED - MIN_STRETCH_SPEED);
+        audio_slice_set_stretch(id, level->stretch, speed);
+    }
+
+    if (level->automate) {
+        uint64_t now = audio_get_frames();
+        uint64_t span = (uint64_t) ((stress.stage_seconds + WARMUP_MS / 1000.0) * AUDIO_SAMPLE_RATE);
+        Param_Point points[] = {
+            {now, 0.25f},
+            {now + span / 2, 1.0f},
+            {now + span, 0.25f},
+        };
+        audio_channel_automate(id, AUDIO_PARAM_VOLUME, points, 3);
+        audio_channel_set(id, AUDIO_PARAM_DELAY_TIME, 0.05f + random_unit() * 0.5f);
+    }
+
+    audio_slice_play(id);
+    stress.voices[stress.nvoices++] = id;
+}
+
+static void percentiles(const Audio_Timing *timing, Stress_Percentiles *out) {
+    out->p50 = percentile(timing, 0.5);
+    out->p90 = percentile(timing, 0.9);
+    out->p99 = percentile(timing, 0.99);
+    out->p999 = percentile(timing, 0.999);
+}
+
+/* The upper edge of the bucket the percentile falls in, so it errs slow. */
+static double percentile(const Audio_Timing *timing, double fraction) {
+    uint64_t rank = (uint64_t) ceil(timing->blocks * fraction);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < AUDIO_TIMING_BUCKETS; i++) {
+        seen += timing->counts[i];
+        if (seen >= rank && seen > 0) {
+            double edge = (i + 1) * timing->bucket_us;
+            return edge < timing->max_us ? edge : timing->max_us;
+        }
+    }
+
+    return timing->max_us;
+}
+
+/* Decaying stereo noise, long enough to reach the reverb's tail stage. */
+static void make_impulse() {
+    stress.ir_frames = (size_t) (REVERB_SECONDS * AUDIO_SAMPLE_RATE);
+    stress.ir = NEW_ARR(float, stress.ir_frames * 2);
+
+    double decay = log(1000.0) / stress.ir_frames;
+    for (size_t i = 0; i < stress.ir_frames; i++) {
+        float env = (float) (0.05 * exp(-decay * i));
+        stress.ir[i * 2] = (random_unit() * 2.0f - 1.0f) * env;
+        stress.ir[i * 2 + 1] = (random_unit() * 2.0f - 1.0f) * env;
+    }
+}
+
+/* xorshift32, in [0, 1). */
+static float random_unit() {
+    uint32_t x = stress.rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    stress.rng = x;
+    return (x >> 8) / 16777216.0f;
+}
@@ -0,0 +1,644 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STRETCH_SSE
+#endif
+
+#include <aleph/fft.h>
+#include <aleph/stretch.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define TWO_PI ((float) (2.0 * M_PI))
+
+/* 23ms windows at half overlap, each placed within 6ms of where it would
+ * fall to best continue the one before. The search steps over lags
+ * WSOLA_COARSE apart, then looks either side of the best of those. */
+#define WSOLA_WINDOW 1024
+#define WSOLA_HOP (WSOLA_WINDOW / 2)
+#define WSOLA_OVERLAP (WSOLA_WINDOW - WSOLA_HOP)
+#define WSOLA_SEEK 256
+#define WSOLA_COARSE 4
+
+/* 46ms windows at quarter overlap. Frequencies are measured between
+ * windows at most VOCODER_MEASURE apart, further than which the phase
+ * wraps too often to follow. */
+#define VOCODER_WINDOW 2048
+#define VOCODER_HOP (VOCODER_WINDOW / 4)
+#define VOCODER_BINS (VOCODER_WINDOW / 2)
+#define VOCODER_MEASURE VOCODER_HOP
+
+/* A Hann window squared sums to 1.5 at quarter overlap. */
+#define VOCODER_OLA_GAIN (1.0f / 1.5f)
+
+#define FIFO_MASK (STRETCH_FIFO_FRAMES - 1)
+
+static struct {
+    Fft fft;
+    float wsola_window[WSOLA_WINDOW];
+    float vocoder_window[VOCODER_WINDOW];
+    float vocoder_synth[VOCODER_WINDOW];
+    float omega[VOCODER_BINS]; /* Radians per frame at the centre of each bin. */
+} stretch_sys;
+
+static void wsola_hop(Stretch *stretch, const Stretch_Source *src, float speed);
+static int64_t wsola_seek(const Stretch_Source *src, int64_t nominal, int64_t follow);
+static void vocoder_hop(Stretch *stretch, const Stretch_Source *src, float speed);
+static void vocoder_analyze(const Stretch_Source *src, int64_t pos, float *buf,
+    float mag[2][VOCODER_BINS], float phase[2][VOCODER_BINS]);
+static void vocoder_advance(const float *phase, float *phase_in, float *phase_out, float since);
+static void vocoder_lock(const float *mag, const float *phase, float *phase_out);
+static void to_polar(float *re_mag, float *im_phase, size_t n);
+static void to_rect(float *mag_re, const float *phase, float *im, size_t n);
+static void advance(Stretch *stretch, const Stretch_Source *src, float speed, size_t hop);
+static void emit(Stretch *stretch, size_t frames, size_t window);
+static void source_frames(const Stretch_Source *src, int64_t pos, size_t frames, float *out);
+static void window_frames(float *data, const float *window, size_t frames);
+static void window_add(float *dst, const float *src, const float *window, size_t frames);
+static float dot(const float *a, const float *b, size_t n);
+static void hann(float *window, size_t n, float gain);
+static float wrap_phase(float phase);
+#ifdef STRETCH_SSE
+static __m128 wrap_phase_ps(__m128 phase);
+static __m128 atan2_ps(__m128 y, __m128 x);
+static void sincos_ps(__m128 x, __m128 *s, __m128 *c);
+#else
+static float fast_atan2(float y, float x);
+static void fast_sincos(float x, float *s, float *c);
+#endif
+
+void stretch_setup() {
+    fft_init(&stretch_sys.fft, VOCODER_WINDOW);
+    hann(stretch_sys.wsola_window, WSOLA_WINDOW, 1.0f);
+    hann(stretch_sys.vocoder_window, VOCODER_WINDOW, 1.0f);
+    hann(stretch_sys.vocoder_synth, VOCODER_WINDOW, VOCODER_OLA_GAIN);
+
+    for (size_t k = 0; k < VOCODER_BINS; k++) {
+        stretch_sys.omega[k] = (float) (2.0 * M_PI * k / VOCODER_WINDOW);
+    }
+}
+
+void stretch_shutdown() {
+    fft_free(&stretch_sys.fft);
+}
+
+void stretch_reset(Stretch *stretch, Stretch_Mode mode, size_t pos, size_t skew) {
+    size_t window = mode == STRETCH_VOCODER ? VOCODER_WINDOW : WSOLA_WINDOW;
+    size_t hop = mode == STRETCH_VOCODER ? VOCODER_HOP : WSOLA_HOP;
+
+    /* The first windows start early and what they make before `pos` is
+     * dropped, so playback opens on a fully overlapped frame. */
+    stretch->mode = mode;
+    stretch->pos = (double) pos - (window - hop);
+    stretch->last = 0;
+    stretch->heard = pos;
+    stretch->primed = false;
+    stretch->done = false;
+    stretch->skew = skew % hop;
+    stretch->skip = window - hop;
+    stretch->fifo_read = 0;
+    stretch->fifo_count = 0;
+    memset(stretch->ola, 0, sizeof(stretch->ola));
+}
+
+size_t stretch_render(Stretch *stretch, const Stretch_Source *src, float speed,
+    float *out, size_t frames) {
+    size_t window = stretch->mode == STRETCH_VOCODER ? VOCODER_WINDOW : WSOLA_WINDOW;
+    size_t hop = stretch->mode == STRETCH_VOCODER ? VOCODER_HOP : WSOLA_HOP;
+
+    if (speed < STRETCH_MIN_SPEED) {
+        speed = STRETCH_MIN_SPEED;
+    } else if (speed > STRETCH_MAX_SPEED) {
+        speed = STRETCH_MAX_SPEED;
+    }
+
+    size_t rendered = 0;
+    while (rendered < frames) {
+        size_t want = frames - rendered < hop ? frames - rendered : hop;
+
+        while (stretch->fifo_count < want + stretch->skew && !stretch->done) {
+            if (!src->loop && stretch->pos > src->end) {
+                /* Out of source: what is still overlapping is final. */
+                emit(stretch, window - hop, window);
+                stretch->done = true;
+            } else if (stretch->mode == STRETCH_VOCODER) {
+                vocoder_hop(stretch, src, speed);
+            } else {
+                wsola_hop(stretch, src, speed);
+            }
+        }
+
+        size_t n = stretch->fifo_count < want ? stretch->fifo_count : want;
+        if (n == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            size_t r = (stretch->fifo_read + i) & FIFO_MASK;
+            out[(rendered + i) * 2] = stretch->fifo[r * 2];
+            out[(rendered + i) * 2 + 1] = stretch->fifo[r * 2 + 1];
+        }
+        stretch->fifo_read = (stretch->fifo_read + n) & FIFO_MASK;
+        stretch->fifo_count -= n;
+        rendered += n;
+    }
+
+    stretch->heard += rendered * speed;
+    if (src->loop && stretch->heard > src->end) {
+        size_t len = src->end - src->start + 1;
+        stretch->heard = src->start + fmod(stretch->heard - src->start, len);
+    }
+
+    return rendered;
+}
+
+size_t stretch_position(const Stretch *stretch) {
+    return stretch->heard > 0.0 ? (size_t) stretch->heard : 0;
+}
+
+/* One window, placed where it best continues the last, overlap-added. */
+static void wsola_hop(Stretch *stretch, const Stretch_Source *src, float speed) {
+    int64_t nominal = (int64_t) floor(stretch->pos + 0.5);
+    int64_t at = stretch->primed ? wsola_seek(src, nominal, stretch->last + WSOLA_HOP) : nominal;
+
+    float frames[WSOLA_WINDOW * 2];
+    source_frames(src, at, WSOLA_WINDOW, frames);
+    window_add(stretch->ola, frames, stretch_sys.wsola_window, WSOLA_WINDOW);
+
+    stretch->last = at;
+    stretch->primed = true;
+    advance(stretch, src, speed, WSOLA_HOP);
+    emit(stretch, WSOLA_HOP, WSOLA_WINDOW);
+}
+
+/* The start within WSOLA_SEEK of `nominal` whose opening looks most like
+ * what follows on from the last window, at `follow`, by normalized cross
+ * correlation of the channels' sum. */
+static int64_t wsola_seek(const Stretch_Source *src, int64_t nominal, int64_t follow) {
+    enum { SPAN = WSOLA_OVERLAP + WSOLA_SEEK * 2 };
+
+    float stereo[SPAN * 2];
+    float target[WSOLA_OVERLAP], region[SPAN];
+    double energy[SPAN + 1];
+
+    source_frames(src, follow, WSOLA_OVERLAP, stereo);
+    for (size_t i = 0; i < WSOLA_OVERLAP; i++) {
+        target[i] = stereo[i * 2] + stereo[i * 2 + 1];
+    }
+
+    source_frames(src, nominal - WSOLA_SEEK, SPAN, stereo);
+    energy[0] = 0.0;
+    for (size_t i = 0; i < SPAN; i++) {
+        region[i] = stereo[i * 2] + stereo[i * 2 + 1];
+        energy[i + 1] = energy[i] + region[i] * region[i];
+    }
+
+    size_t best = WSOLA_SEEK;
+    float best_score = -INFINITY;
+    size_t lo = 0, hi = WSOLA_SEEK * 2, step = WSOLA_COARSE;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t lag = lo; lag <= hi; lag += step) {
+            double e = energy[lag + WSOLA_OVERLAP] - energy[lag];
+            float score = dot(target, &region[lag], WSOLA_OVERLAP) / sqrtf((float) e + 1e-9f);
+            if (score > best_score) {
+                best_score = score;
+                best = lag;
+            }
+        }
+
+        lo = best >= WSOLA_COARSE ? best - (WSOLA_COARSE - 1) : 0;
+        hi = best + (WSOLA_COARSE - 1) <= WSOLA_SEEK * 2 ? best + (WSOLA_COARSE - 1) : WSOLA_SEEK * 2;
+        step = 1;
+    }
+
+    return nominal - WSOLA_SEEK + (int64_t) best;
+}
+
+/* Both channels go through one complex FFT as its real and imaginary
+ * parts. Each bin's phase moves on by the frequency measured in it, and the
+ * result comes back out of one inverse FFT the same way. */
+static void vocoder_hop(Stretch *stretch, const Stretch_Source *src, float speed) {
+    float buf[VOCODER_WINDOW * 2];
+    float mag[2][VOCODER_BINS], phase[2][VOCODER_BINS];
+
+    int64_t at = (int64_t) floor(stretch->pos + 0.5);
+    int64_t since = at - stretch->last;
+    if (src->loop && since < 0) {
+        since += src->end - src->start + 1;
+    }
+
+    /* Without the last window close enough behind, measure against one
+     * that is. */
+    bool measure = stretch->primed && (since <= 0 || since > VOCODER_MEASURE);
+    if (measure) {
+        vocoder_analyze(src, at - VOCODER_MEASURE, buf, mag, stretch->phase_in);
+        since = VOCODER_MEASURE;
+    }
+
+    vocoder_analyze(src, at, buf, mag, phase);
+
+    for (int c = 0; c < 2; c++) {
+        if (stretch->primed) {
+            vocoder_advance(phase[c], stretch->phase_in[c], stretch->phase_out[c], (float) since);
+            vocoder_lock(mag[c], phase[c], stretch->phase_out[c]);
+        } else {
+            memcpy(stretch->phase_in[c], phase[c], sizeof(phase[c]));
+            memcpy(stretch->phase_out[c], phase[c], sizeof(phase[c]));
+        }
+
+        /* Into the same arrays, now real and imaginary. */
+        to_rect(mag[c], stretch->phase_out[c], phase[c], VOCODER_BINS);
+    }
+
+    /* Left in the real part, right in the imaginary. Bins 0 and N/2 keep
+     * what the forward FFT left in them, real as they must stay. */
+    const size_t n = VOCODER_WINDOW;
+    for (size_t k = 1; k < VOCODER_BINS; k++) {
+        float l_re = mag[0][k], l_im = phase[0][k];
+        float r_re = mag[1][k], r_im = phase[1][k];
+        buf[k * 2] = l_re - r_im;
+        buf[k * 2 + 1] = l_im + r_re;
+        buf[(n - k) * 2] = l_re + r_im;
+        buf[(n - k) * 2 + 1] = r_re - l_im;
+    }
+
+    fft_inverse(&stretch_sys.fft, buf);
+    window_add(stretch->ola, buf, stretch_sys.vocoder_synth, VOCODER_WINDOW);
+
+    stretch->last = at;
+    stretch->primed = true;
+    advance(stretch, src, speed, VOCODER_HOP);
+    emit(stretch, VOCODER_HOP, VOCODER_WINDOW);
+}
+
+/* Leaves the window's spectrum in `buf` and the magnitude and phase of each
+ * channel's bins below N/2. */
+static void vocoder_analyze(const Stretch_Source *src, int64_t pos, float *buf,
+    float mag[2][VOCODER_BINS], float phase[2][VOCODER_BINS]) {
+    const size_t n = VOCODER_WINDOW;
+
+    source_frames(src, pos, n, buf);
+    window_frames(buf, stretch_sys.vocoder_window, n);
+    fft_forward(&stretch_sys.fft, buf);
+
+    /* Bin k of the left is half Z[k] plus conj(Z[N-k]); of the right, half
+     * the difference over i. Bin 0 isn't used, so Z[N] is never needed. */
+    mag[0][0] = phase[0][0] = mag[1][0] = phase[1][0] = 0.0f;
+    for (size_t k = 1; k < VOCODER_BINS; k++) {
+        float a = buf[k * 2], b = buf[k * 2 + 1];
+        float c = buf[(n - k) * 2], d = buf[(n - k) * 2 + 1];
+        mag[0][k] = (a + c) * 0.5f;
+        phase[0][k] = (b - d) * 0.5f;
+        mag[1][k] = (b + d) * 0.5f;
+        phase[1][k] = (c - a) * 0.5f;
+    }
+
+    to_polar(mag[0], phase[0], VOCODER_BINS);
+    to_polar(mag[1], phase[1], VOCODER_BINS);
+}
+
+/* Moves each bin's phase on by a hop at the frequency measured in it from
+ * the last window, `since` frames back. */
+static void vocoder_advance(const float *phase, float *phase_in, float *phase_out, float since) {
+    const float *omega = stretch_sys.omega;
+    float inv_since = 1.0f / since;
+
+#ifdef STRETCH_SSE
+    __m128 vsince = _mm_set1_ps(since);
+    __m128 vinv = _mm_set1_ps(inv_since);
+    __m128 vhop = _mm_set1_ps(VOCODER_HOP);
+    for (size_t k = 0; k < VOCODER_BINS; k += 4) {
+        __m128 w = _mm_loadu_ps(&omega[k]);
+        __m128 p = _mm_loadu_ps(&phase[k]);
+        __m128 expected = _mm_add_ps(_mm_loadu_ps(&phase_in[k]), _mm_mul_ps(w, vsince));
+        __m128 delta = wrap_phase_ps(_mm_sub_ps(p, expected));
+        __m128 freq = _mm_add_ps(w, _mm_mul_ps(delta, vinv));
+        __m128 out = wrap_phase_ps(_mm_add_ps(_mm_loadu_ps(&phase_out[k]), _mm_mul_ps(freq, vhop)));
+        _mm_storeu_ps(&phase_in[k], p);
+        _mm_storeu_ps(&phase_out[k], out);
+    }
+#else
+    for (size_t k = 0; k < VOCODER_BINS; k++) {
+        float delta = wrap_phase(phase[k] - (phase_in[k] + omega[k] * since));
+        float freq = omega[k] + delta * inv_since;
+        phase_in[k] = phase[k];
+        phase_out[k] = wrap_phase(phase_out[k] + freq * VOCODER_HOP);
+    }
+#endif
+}
+
+/* Identity phase locking: only peaks keep the phase they were advanced to.
+ * The bins around each, out to the quietest bin before the next, take the
+ * peak's phase plus their offset from it in the analysis. A partial's bins
+ * then stay in step, where on their own the errors of each (from a window
+ * running off the source, say) would set them beating for good. */
+static void vocoder_lock(const float *mag, const float *phase, float *phase_out) {
+    size_t peaks[VOCODER_BINS / 2];
+    size_t npeaks = 0;
+    for (size_t k = 2; k + 2 < VOCODER_BINS; k++) {
+        if (mag[k] > mag[k - 1] && mag[k] > mag[k - 2] && mag[k] >= mag[k + 1] && mag[k] >= mag[k + 2]) {
+            peaks[npeaks++] = k;
+        }
+    }
+
+    size_t lo = 0;
+    for (size_t i = 0; i < npeaks; i++) {
+        size_t peak = peaks[i];
+        size_t hi = VOCODER_BINS;
+        if (i + 1 < npeaks) {
+            hi = peak + 1;
+            for (size_t k = peak + 1; k < peaks[i + 1]; k++) {
+                if (mag[k] < mag[hi]) {
+                    hi = k;
+                }
+            }
+        }
+
+        float shift = phase_out[peak] - phase[peak];
+        for (size_t k = lo; k < hi; k++) {
+            if (k != peak) {
+                phase_out[k] = wrap_phase(phase[k] + shift);
+            }
+        }
+        lo = hi;
+    }
+}
+
+/* In place: real and imaginary parts in, magnitude and phase out. */
+static void to_polar(float *re_mag, float *im_phase, size_t n) {
+#ifdef STRETCH_SSE
+    for (size_t k = 0; k < n; k += 4) {
+        __m128 re = _mm_loadu_ps(&re_mag[k]);
+        __m128 im = _mm_loadu_ps(&im_phase[k]);
+        __m128 mag = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+        _mm_storeu_ps(&re_mag[k], mag);
+        _mm_storeu_ps(&im_phase[k], atan2_ps(im, re));
+    }
+#else
+    for (size_t k = 0; k < n; k++) {
+        float re = re_mag[k], im = im_phase[k];
+        re_mag[k] = sqrtf(re * re + im * im);
+        im_phase[k] = fast_atan2(im, re);
+    }
+#endif
+}
+
+/* Magnitude in `mag_re` and `phase` in, real part out in `mag_re` and the
+ * imaginary in `im`. */
+static void to_rect(float *mag_re, const float *phase, float *im, size_t n) {
+#ifdef STRETCH_SSE
+    for (size_t k = 0; k < n; k += 4) {
+        __m128 mag = _mm_loadu_ps(&mag_re[k]);
+        __m128 s, c;
+        sincos_ps(_mm_loadu_ps(&phase[k]), &s, &c);
+        _mm_storeu_ps(&mag_re[k], _mm_mul_ps(mag, c));
+        _mm_storeu_ps(&im[k], _mm_mul_ps(mag, s));
+    }
+#else
+    for (size_t k = 0; k < n; k++) {
+        float s, c;
+        fast_sincos(phase[k], &s, &c);
+        im[k] = mag_re[k] * s;
+        mag_re[k] *= c;
+    }
+#endif
+}
+
+static void advance(Stretch *stretch, const Stretch_Source *src, float speed, size_t hop) {
+    stretch->pos += hop * speed;
+    if (src->loop && stretch->pos > src->end) {
+        stretch->pos -= src->end - src->start + 1;
+    }
+}
+
+/* Moves the first `frames` frames of the overlap-add, which no window still
+ * to come reaches, into the fifo. */
+static void emit(Stretch *stretch, size_t frames, size_t window) {
+    for (size_t i = 0; i < frames; i++) {
+        if (stretch->skip > 0) {
+            stretch->skip--;
+            continue;
+        }
+
+        size_t w = (stretch->fifo_read + stretch->fifo_count) & FIFO_MASK;
+        stretch->fifo[w * 2] = stretch->ola[i * 2];
+        stretch->fifo[w * 2 + 1] = stretch->ola[i * 2 + 1];
+        stretch->fifo_count++;
+    }
+
+    size_t keep = window - frames;
+    memmove(stretch->ola, &stretch->ola[frames * 2], keep * 2 * sizeof(float));
+    memset(&stretch->ola[keep * 2], 0, frames * 2 * sizeof(float));
+}
+
+/* Silence either side of a one-shot source; a looped one wraps around. */
+static void source_frames(const Stretch_Source *src, int64_t pos, size_t frames, float *out) {
+    int64_t start = src->start, end = src->end;
+    if (src->nchannels == 2 && pos >= start && pos + (int64_t) frames - 1 <= end) {
+        memcpy(out, &src->data[pos * 2], frames * 2 * sizeof(float));
+        return;
+    }
+
+    int right = src->nchannels > 1 ? 1 : 0;
+
+    int64_t len = end - start + 1;
+    for (size_t i = 0; i < frames; i++) {
+        int64_t p = pos + (int64_t) i;
+        if (src->loop) {
+            p = start + ((p - start) % len + len) % len;
+        } else if (p < start || p > end) {
+            out[i * 2] = 0.0f;
+            out[i * 2 + 1] = 0.0f;
+            continue;
+        }
+
+        const float *frame = &src->data[p * src->nchannels];
+        out[i * 2] = frame[0];
+        out[i * 2 + 1] = frame[right];
+    }
+}
+
+/* Window lengths and overlaps are all multiples of 8, so the vector loops
+ * below need no tails. */
+static void window_frames(float *data, const float *window, size_t frames) {
+#ifdef STRETCH_SSE
+    for (size_t i = 0; i < frames; i += 4) {
+        __m128 w = _mm_loadu_ps(&window[i]);
+        __m128 lo = _mm_loadu_ps(&data[i * 2]);
+        __m128 hi = _mm_loadu_ps(&data[i * 2 + 4]);
+        _mm_storeu_ps(&data[i * 2], _mm_mul_ps(lo, _mm_unpacklo_ps(w, w)));
+        _mm_storeu_ps(&data[i * 2 + 4], _mm_mul_ps(hi, _mm_unpackhi_ps(w, w)));
+    }
+#else
+    for (size_t i = 0; i < frames; i++) {
+        data[i * 2] *= window[i];
+        data[i * 2 + 1] *= window[i];
+    }
+#endif
+}
+
+static void window_add(float *dst, const float *src, const float *window, size_t frames) {
+#ifdef STRETCH_SSE
+    for (size_t i = 0; i < frames; i += 4) {
+        __m128 w = _mm_loadu_ps(&window[i]);
+        __m128 lo = _mm_mul_ps(_mm_loadu_ps(&src[i * 2]), _mm_unpacklo_ps(w, w));
+        __m128 hi = _mm_mul_ps(_mm_loadu_ps(&src[i * 2 + 4]), _mm_unpackhi_ps(w, w));
+        _mm_storeu_ps(&dst[i * 2], _mm_add_ps(_mm_loadu_ps(&dst[i * 2]), lo));
+        _mm_storeu_ps(&dst[i * 2 + 4], _mm_add_ps(_mm_loadu_ps(&dst[i * 2 + 4]), hi));
+    }
+#else
+    for (size_t i = 0; i < frames; i++) {
+        dst[i * 2] += src[i * 2] * window[i];
+        dst[i * 2 + 1] += src[i * 2 + 1] * window[i];
+    }
+#endif
+}
+
+static float dot(const float *a, const float *b, size_t n) {
+    float sum = 0.0f;
+#ifdef STRETCH_SSE
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(&a[i + 4]), _mm_loadu_ps(&b[i + 4])));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    sum = _mm_cvtss_f32(acc0);
+#else
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+#endif
+    return sum;
+}
+
+/* Periodic, so copies a half or quarter window apart sum flat. */
+static void hann(float *window, size_t n, float gain) {
+    for (size_t i = 0; i < n; i++) {
+        window[i] = gain * (0.5 - 0.5 * cos(2.0 * M_PI * i / n));
+    }
+}
+
+static float wrap_phase(float phase) {
+    return phase - TWO_PI * floorf(phase / TWO_PI + 0.5f);
+}
+
+#ifdef STRETCH_SSE
+
+static __m128 wrap_phase_ps(__m128 phase) {
+    __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(phase, _mm_set1_ps(1.0f / TWO_PI))));
+    return _mm_sub_ps(phase, _mm_mul_ps(turns, _mm_set1_ps(TWO_PI)));
+}
+
+/* Within 1e-5 radians, which is far finer than the phase needs. */
+static __m128 atan2_ps(__m128 y, __m128 x) {
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 ax = _mm_andnot_ps(sign, x);
+    __m128 ay = _mm_andnot_ps(sign, y);
+    __m128 hi = _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f));
+    __m128 a = _mm_div_ps(_mm_min_ps(ax, ay), hi);
+    __m128 s = _mm_mul_ps(a, a);
+
+    __m128 r = _mm_set1_ps(0.0208351f);
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.085133f));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.180141f));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.3302995f));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.999866f));
+    r = _mm_mul_ps(r, a);
+
+    __m128 steep = _mm_cmpgt_ps(ay, ax);
+    r = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps((float) (M_PI / 2)), r)),
+        _mm_andnot_ps(steep, r));
+    __m128 left = _mm_cmplt_ps(x, _mm_setzero_ps());
+    r = _mm_or_ps(_mm_and_ps(left, _mm_sub_ps(_mm_set1_ps((float) M_PI), r)),
+        _mm_andnot_ps(left, r));
+    return _mm_or_ps(r, _mm_and_ps(y, sign));
+}
+
+/* Reduced to within an eighth of a turn, where short series do, then put
+ * back in its quadrant. */
+static void sincos_ps(__m128 x, __m128 *s, __m128 *c) {
+    __m128i q = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps((float) (2.0 / M_PI))));
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(_mm_cvtepi32_ps(q), _mm_set1_ps((float) (M_PI / 2))));
+    __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 sr = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(-1.0f / 5040)), _mm_set1_ps(1.0f / 120));
+    sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(-1.0f / 6));
+    sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(1.0f));
+    sr = _mm_mul_ps(sr, r);
+
+    __m128 cr = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(-1.0f / 720)), _mm_set1_ps(1.0f / 24));
+    cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(-0.5f));
+    cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(1.0f));
+
+    __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+    __m128 sin_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, two), 30));
+    __m128 cos_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, one), two), 30));
+
+    *s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, cr), _mm_andnot_ps(swap, sr)), sin_sign);
+    *c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, sr), _mm_andnot_ps(swap, cr)), cos_sign);
+}
+
+#else
+
+/* Within 1e-5 radians, which is far finer than the phase needs. */
+static float fast_atan2(float y, float x) {
+    float ax = fabsf(x), ay = fabsf(y);
+    float hi = ax > ay ? ax : ay;
+    float lo = ax > ay ? ay : ax;
+    if (hi == 0.0f) {
+        return 0.0f;
+    }
+
+    float a = lo / hi;
+    float s = a * a;
+    float r = ((((0.0208351f * s - 0.085133f) * s + 0.180141f) * s - 0.3302995f) * s + 0.999866f) * a;
+
+    if (ay > ax) {
+        r = (float) (M_PI / 2) - r;
+    }
+    if (x < 0.0f) {
+        r = (float) M_PI - r;
+    }
+    return y < 0.0f ? -r : r;
+}
+
+/* Reduced to within an eighth of a turn, where short series do, then put
+ * back in its quadrant. */
+static void fast_sincos(float x, float *s, float *c) {
+    float q = floorf(x * (float) (2.0 / M_PI) + 0.5f);
+    float r = x - q * (float) (M_PI / 2);
+    float r2 = r * r;
+
+    float sr = r * (1.0f + r2 * (-1.0f / 6 + r2 * (1.0f / 120 - r2 * (1.0f / 5040))));
+    float cr = 1.0f + r2 * (-0.5f + r2 * (1.0f / 24 - r2 * (1.0f / 720)));
+
+    switch ((int) q & 3) {
+        case 0:
+            *s = sr;
+            *c = cr;
+            break;
+        case 1:
+            *s = cr;
+            *c = -sr;
+            break;
+        case 2:
+            *s = -sr;
+            *c = -cr;
+            break;
+        default:
+            *s = -cr;
+            *c = sr;
+            break;
+    }
+}
+
+#endif
@@ -0,0 +1,50 @@
+#include <SDL.h>
+
+#include <aleph/triple.h>
+
+/* Set in `middle` when it holds a snapshot the reader hasn't taken yet. */
+#define TRIPLE_FRESH 4
+
+struct Triple {
+    uint8_t *bufs[3];
+    SDL_atomic_t middle;
+    int back, front; /* Each only touched by its own side. */
+};
+
+Triple *triple_create(size_t size) {
+    Triple *triple = NEW(Triple);
+    for (int i = 0; i < 3; i++) {
+        triple->bufs[i] = NEW_ARR(uint8_t, size);
+    }
+
+    triple->back = 0;
+    triple->front = 2;
+    SDL_AtomicSet(&triple->middle, 1);
+
+    return triple;
+}
+
+void triple_free(Triple *triple) {
+    for (int i = 0; i < 3; i++) {
+        FREE(triple->bufs[i]);
+    }
+    FREE(triple);
+}
+
+void *triple_back(Triple *triple) {
+    return triple->bufs[triple->back];
+}
+
+void triple_publish(Triple *triple) {
+    int old = SDL_AtomicSet(&triple->middle, triple->back | TRIPLE_FRESH);
+    triple->back = old & 3;
+}
+
+const void *triple_read(Triple *triple) {
+    if (SDL_AtomicGet(&triple->middle) & TRIPLE_FRESH) {
+        int old = SDL_AtomicSet(&triple->middle, triple->front);
+        triple->front = old & 3;
+    }
+
+    return triple->bufs[triple->front];
+}
@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+
+#include <SDL.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <aleph/alloc.h>
+#include <aleph/workers.h>
+
+#define MAX_WORKERS 63
+
+/* How long idle helpers keep polling for the next run before sleeping. The
+ * realtime value is longer than one audio block so helpers stay hot while the
+ * stream is busy, and the callback only pays for a wake-up after a pause. */
+#define REALTIME_SPIN_US 2000
+#define OFFLINE_SPIN_US 50
+
+#define CACHE_LINE 64
+
+/* Each participant owns one queue: a contiguous range of indices claimed
+ * from the front. Once its own range is empty it steals from the others. */
+typedef struct {
+    SDL_atomic_t next;
+    int end;
+    char pad[CACHE_LINE - sizeof(SDL_atomic_t) - sizeof(int)];
+} Work_Queue;
+
+typedef struct {
+    Worker_Pool *pool;
+    SDL_Thread *thread;
+    SDL_sem *wake;
+    SDL_atomic_t sleeping;
+    int slot;
+} Worker;
+
+struct Worker_Pool {
+    int nthreads;
+    bool realtime;
+    Uint64 spin_ticks;
+
+    Work_Queue queues[MAX_WORKERS + 1];
+    Worker workers[MAX_WORKERS];
+
+    Work_Fn fn;
+    void *ud;
+
+    SDL_atomic_t generation;
+    SDL_atomic_t open;
+    SDL_atomic_t busy;
+    SDL_atomic_t done;
+    SDL_atomic_t quit;
+};
+
+static int worker_thread(void *ud);
+static int worker_wait(Worker *worker, int seen);
+static void worker_pin(int core);
+static void pool_drain(Worker_Pool *pool, int slot);
+static void cpu_relax();
+
+Worker_Pool *workers_create(int nthreads, bool realtime) {
+    if (nthreads <= 0) {
+        nthreads = SDL_GetCPUCount() - 1;
+    }
+
+    if (nthreads > MAX_WORKERS) {
+        nthreads = MAX_WORKERS;
+    }
+
+    Worker_Pool *pool = NEW(Worker_Pool);
+    pool->nthreads = nthreads;
+    pool->realtime = realtime;
+    pool->spin_ticks = SDL_GetPerformanceFrequency()
+        * (realtime ? REALTIME_SPIN_US : OFFLINE_SPIN_US) / 1000000;
+
+    SDL_AtomicSet(&pool->generation, 0);
+    SDL_AtomicSet(&pool->open, 0);
+    SDL_AtomicSet(&pool->busy, 0);
+    SDL_AtomicSet(&pool->quit, 0);
+
+    for (int i = 0; i < nthreads; i++) {
+        Worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->slot = i + 1;
+        worker->wake = SDL_CreateSemaphore(0);
+        SDL_AtomicSet(&worker->sleeping, 0);
+        worker->thread = SDL_CreateThread(worker_thread, "worker", worker);
+    }
+
+    LOG_FMT("worker pool started with %d helper threads", nthreads);
+
+    return pool;
+}
+
+void workers_free(Worker_Pool *pool) {
+    if (!pool) {
+        return;
+    }
+
+    SDL_AtomicSet(&pool->quit, 1);
+    SDL_AtomicAdd(&pool->generation, 1);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        Worker *worker = &pool->workers[i];
+        if (SDL_AtomicCAS(&worker->sleeping, 1, 0)) {
+            SDL_SemPost(worker->wake);
+        }
+    }
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        SDL_WaitThread(pool->workers[i].thread, NULL);
+        SDL_DestroySemaphore(pool->workers[i].wake);
+    }
+
+    FREE(pool);
+}
+
+int workers_count(Worker_Pool *pool) {
+    return pool->nthreads + 1;
+}
+
+void workers_run(Worker_Pool *pool, size_t count, Work_Fn fn, void *ud) {
+    if (count == 0) {
+        return;
+    }
+
+    if (pool->nthreads == 0 || count == 1) {
+        for (size_t i = 0; i < count; i++) {
+            fn(ud, i);
+        }
+        return;
+    }
+
+    pool->fn = fn;
+    pool->ud = ud;
+
+    int nqueues = pool->nthreads + 1;
+    for (int i = 0; i < nqueues; i++) {
+        Work_Queue *queue = &pool->queues[i];
+        SDL_AtomicSet(&queue->next, (count * i) / nqueues);
+        queue->end = (count * (i + 1)) / nqueues;
+    }
+
+    SDL_AtomicSet(&pool->done, 0);
+    SDL_AtomicSet(&pool->open, 1);
+    SDL_AtomicAdd(&pool->generation, 1);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        Worker *worker = &pool->workers[i];
+        if (SDL_AtomicCAS(&worker->sleeping, 1, 0)) {
+            SDL_SemPost(worker->wake);
+        }
+    }
+
+    pool_drain(pool, 0);
+
+    while (SDL_AtomicGet(&pool->done) < (int) count) {
+        cpu_relax();
+    }
+
+    /* Helpers that have not joined yet see the run closed and back off, so
+     * we only wait on the ones that are still inside pool_drain. */
+    SDL_AtomicSet(&pool->open, 0);
+    while (SDL_AtomicGet(&pool->busy) > 0) {
+        cpu_relax();
+    }
+}
+
+static int worker_thread(void *ud) {
+    Worker *worker = (Worker *) ud;
+    Worker_Pool *pool = worker->pool;
+
+    if (pool->realtime) {
+        worker_pin(worker->slot);
+        SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
+        alloc_set_realtime(true);
+    }
+
+    int seen = 0;
+    for (;;) {
+        seen = worker_wait(worker, seen);
+        if (SDL_AtomicGet(&pool->quit)) {
+            break;
+        }
+
+        SDL_AtomicAdd(&pool->busy, 1);
+        if (SDL_AtomicGet(&pool->open)) {
+            pool_drain(pool, worker->slot);
+        }
+        SDL_AtomicAdd(&pool->busy, -1);
+    }
+
+    return 0;
+}
+
+static int worker_wait(Worker *worker, int seen) {
+    Worker_Pool *pool = worker->pool;
+
+    Uint64 spin_start = SDL_GetPerformanceCounter();
+    do {
+        int gen = SDL_AtomicGet(&pool->generation);
+        if (gen != seen) {
+            return gen;
+        }
+        cpu_relax();
+    } while (SDL_GetPerformanceCounter() - spin_start < pool->spin_ticks);
+
+    SDL_AtomicSet(&worker->sleeping, 1);
+
+    int gen = SDL_AtomicGet(&pool->generation);
+    if (gen != seen && SDL_AtomicCAS(&worker->sleeping, 1, 0)) {
+        return gen;
+    }
+
+    /* Either nothing is pending, or the runner already cleared our flag and
+     * posted, in which case this returns straight away. */
+    SDL_SemWait(worker->wake);
+    return SDL_AtomicGet(&pool->generation);
+}
+
+static void pool_drain(Worker_Pool *pool, int slot) {
+    int nqueues = pool->nthreads + 1;
+    for (int k = 0; k < nqueues; k++) {
+        Work_Queue *queue = &pool->queues[(slot + k) % nqueues];
+        for (;;) {
+            int index = SDL_AtomicAdd(&queue->next, 1);
+            if (index >= queue->end) {
+                break;
+            }
+
+            pool->fn(pool->ud, index);
+            SDL_AtomicAdd(&pool->done, 1);
+        }
+    }
+}
+
+static void worker_pin(int core) {
+    int ncores = SDL_GetCPUCount();
+    if (ncores <= 1) {
+        return;
+    }
+
+    core %= ncores;
+
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR) 1) << core);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    IGNORE(core);
+#endif
+}
+
+static void cpu_relax() {
+#if defined(__SSE2__)
+    _mm_pause();
+#else
+    SDL_CompilerBarrier();
+#endif
+}
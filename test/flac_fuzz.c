@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <aleph/defs.h>
+#include <aleph/flac.h>
+#include <aleph/log.h>
+
+/* Feeds flac_decode single frame streams whose subframes are well formed
+ * but hold residuals no encoder would write, so prediction runs far past
+ * 32 bits. Sums must wrap: fixed predictors and stereo decorrelation are
+ * checked against unsigned arithmetic, LPC just has to come through. Build
+ * with `make test SANITIZE=1` to catch overflow the checks can't see. */
+
+#define ROUNDS 20000
+#define MAX_BLOCK 256
+#define MAX_BYTES (64 * 1024)
+
+typedef struct {
+    uint8_t *data;
+    size_t bits;
+} Bit_Writer;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+static uint32_t rng();
+static uint32_t rng_range(uint32_t lo, uint32_t hi);
+static void bw_write(Bit_Writer *bw, uint32_t value, int n);
+static void bw_align(Bit_Writer *bw);
+static uint8_t crc8(const uint8_t *data, size_t len);
+static uint16_t crc16(const uint8_t *data, size_t len);
+static void write_subframe(Bit_Writer *bw, uint32_t block, int bps, bool lpc, uint32_t *expect);
+static void restore_fixed(uint32_t *out, uint32_t block, int order);
+
+int main() {
+    static uint8_t data[MAX_BYTES];
+    static uint32_t expect[2][MAX_BLOCK];
+    size_t checked = 0;
+
+    log_set_level(LOG_LEVEL_WARN);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        static const int depths[] = {8, 12, 16, 20, 24};
+        static const int pairs[] = {1, 8, 9, 10}; /* Left/right, then the stereo modes. */
+        int bps = depths[rng_range(0, 4)];
+        int nchannels = rng_range(1, 2);
+        int assignment = nchannels == 1 ? 0 : pairs[rng_range(0, 3)];
+        uint32_t block = rng_range(1, MAX_BLOCK);
+        bool lpc = rng_range(0, 1);
+
+        memset(data, 0, sizeof(data));
+        Bit_Writer bw = {data, 0};
+
+        bw_write(&bw, 'f', 8);
+        bw_write(&bw, 'L', 8);
+        bw_write(&bw, 'a', 8);
+        bw_write(&bw, 'C', 8);
+        bw_write(&bw, 0x80, 8);
+        bw_write(&bw, 34, 24);
+        bw_write(&bw, 16, 16);
+        bw_write(&bw, MAX_BLOCK, 16);
+        bw_write(&bw, 0, 24);
+        bw_write(&bw, 0, 24);
+        bw_write(&bw, 44100, 20);
+        bw_write(&bw, nchannels - 1, 3);
+        bw_write(&bw, bps - 1, 5);
+        bw_write(&bw, 0, 4);
+        bw_write(&bw, block, 32);
+        for (int i = 0; i < 4; i++) {
+            bw_write(&bw, 0, 32);
+        }
+
+        size_t frame = bw.bits / 8;
+        bw_write(&bw, 0xFFF8, 16);
+        bw_write(&bw, 0x60, 8); /* Block size in a byte, rate from STREAMINFO. */
+        bw_write(&bw, assignment << 4, 8);
+        bw_write(&bw, 0, 8);
+        bw_write(&bw, block - 1, 8);
+        bw_write(&bw, crc8(data + frame, bw.bits / 8 - frame), 8);
+
+        for (int chan = 0; chan < nchannels; chan++) {
+            bool side = (assignment == 8 && chan == 1) || (assignment == 9 && chan == 0)
+                || (assignment == 10 && chan == 1);
+            write_subframe(&bw, block, bps + side, lpc, expect[chan]);
+        }
+        bw_align(&bw);
+        bw_write(&bw, crc16(data + frame, bw.bits / 8 - frame), 16);
+
+        Audio_File file;
+        if (!flac_decode(&file, data, bw.bits / 8, NULL)) {
+            FAIL_FMT("round %d: stream rejected", round);
+        }
+
+        if (!lpc) {
+            uint32_t *a = expect[0], *b = expect[1];
+            for (uint32_t i = 0; i < block && nchannels == 2; i++) {
+                if (assignment == 8) {
+                    b[i] = a[i] - b[i];
+                } else if (assignment == 9) {
+                    a[i] += b[i];
+                } else if (assignment == 10) {
+                    uint32_t mid = (a[i] << 1) | (b[i] & 1);
+                    uint32_t side = b[i];
+                    a[i] = (int32_t) (mid + side) >> 1;
+                    b[i] = (int32_t) (mid - side) >> 1;
+                }
+            }
+
+            float scale = 1.0f / (float) (1 << (bps - 1));
+            for (uint32_t i = 0; i < block; i++) {
+                for (int chan = 0; chan < nchannels; chan++) {
+                    float want = (int32_t) expect[chan][i] * scale;
+                    if (file.data.f32[i * nchannels + chan] != want) {
+                        FAIL_FMT("round %d: sample %d of channel %d is %f, not %f", round,
+                            (int) i, chan, file.data.f32[i * nchannels + chan], want);
+                    }
+                }
+            }
+            checked++;
+        }
+
+        FREE(file.data.f32);
+    }
+
+    printf("flac_fuzz: %d corrupt frames decoded, %d checked exactly\n", ROUNDS, (int) checked);
+    return 0;
+}
+
+static uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t) (rng_state >> 32);
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi) {
+    return lo + rng() % (hi - lo + 1);
+}
+
+static void bw_write(Bit_Writer *bw, uint32_t value, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        if ((value >> i) & 1) {
+            bw->data[bw->bits / 8] |= 0x80 >> (bw->bits % 8);
+        }
+        bw->bits++;
+    }
+}
+
+static void bw_align(Bit_Writer *bw) {
+    bw->bits = (bw->bits + 7) & ~(size_t) 7;
+}
+
+static uint8_t crc8(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/* Warm up samples at full scale and every residual escaped at up to 31
+ * bits. `expect` gets the fixed predictor's output, wrapped. */
+static void write_subframe(Bit_Writer *bw, uint32_t block, int bps, bool lpc, uint32_t *expect) {
+    uint32_t max_order = lpc ? 32 : 4;
+    int order = rng_range(lpc, block < max_order ? block : max_order);
+
+    bw_write(bw, 0, 1);
+    bw_write(bw, lpc ? 31 + order : 8 + order, 6);
+    bw_write(bw, 0, 1);
+
+    for (int i = 0; i < order; i++) {
+        uint32_t value = rng() & (0xFFFFFFFFu >> (32 - bps));
+        bw_write(bw, value, bps);
+        expect[i] = (int32_t) (value << (32 - bps)) >> (32 - bps);
+    }
+
+    if (lpc) {
+        int precision = rng_range(1, 15);
+        bw_write(bw, precision - 1, 4);
+        bw_write(bw, rng_range(0, 15), 5);
+        for (int i = 0; i < order; i++) {
+            bw_write(bw, rng(), precision);
+        }
+    }
+
+    int bits = rng_range(1, 31);
+    bw_write(bw, 0, 2);
+    bw_write(bw, 0, 4);
+    bw_write(bw, 15, 4);
+    bw_write(bw, bits, 5);
+    for (uint32_t i = order; i < block; i++) {
+        uint32_t value = rng() & (0xFFFFFFFFu >> (32 - bits));
+        bw_write(bw, value, bits);
+        expect[i] = (int32_t) (value << (32 - bits)) >> (32 - bits);
+    }
+
+    if (!lpc) {
+        restore_fixed(expect, block, order);
+    }
+}
+
+static void restore_fixed(uint32_t *out, uint32_t block, int order) {
+    static const int taps[5][4] = {
+        {0}, {1}, {2, -1}, {3, -3, 1}, {4, -6, 4, -1},
+    };
+
+    for (uint32_t i = order; i < block; i++) {
+        for (int j = 0; j < order; j++) {
+            out[i] += taps[order][j] * out[i - 1 - j];
+        }
+    }
+}